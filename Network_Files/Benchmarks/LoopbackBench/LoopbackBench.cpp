@@ -0,0 +1,765 @@
+// LoopbackBench: headless baseline for SimpleNet over 127.0.0.1.
+//
+// Spins up one NetServer (on its own thread) and N NetClients, then measures:
+//  - round-trip latency percentiles per reliability mode
+//  - max messages/s and bytes/s per reliability mode
+//  - broadcast fan-out cost versus peer count
+//  - server CPU time per service() tick
+//  - client datagrams per message with FlushPolicy Immediate versus Coalesced
+//  - syscalls per datagram for a ServerBrowser probing 64 candidates (DatagramBatch)
+//  - host socket syscalls per datagram during the throughput runs (HostBatching, needs ENet
+//    built with enet/src/unix_batched.c and SIMPLENET_ENET_BATCHING, otherwise reported as unavailable)
+//
+// Results are written as JSON to stdout, or to the file given with --out.
+//
+// Usage: LoopbackBench [--clients N] [--port P] [--seconds S] [--samples K] [--size BYTES]
+//                      [--compression none|range|lz|trained] [--model FILE] [--out FILE]
+
+#include "SimpleNet.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    //Message opcodes understood by the bench server.
+    enum Op : uint8_t
+    {
+        OpEcho = 1,   //Server sends the packet back to the sender
+        OpSink = 2,   //Server only counts the packet
+        OpFanout = 3  //Server broadcasts the packet to every peer
+    };
+
+    struct Options
+    {
+        uint32_t clients = 16;
+        uint16_t port = 47700;
+        double seconds = 2.0;
+        uint32_t samples = 2000;
+        uint32_t payloadSize = 64;
+        SimpleNet::Compression compression = SimpleNet::Compression::None;
+        std::shared_ptr<const SimpleNet::TrainedModel> model;
+        std::string outPath;
+    };
+
+    uint64_t nowNs()
+    {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count());
+    }
+
+    //CPU time consumed by the calling thread, in microseconds.
+    uint64_t threadCpuMicros()
+    {
+#ifdef _WIN32
+        FILETIME creation, exitTime, kernel, user;
+        GetThreadTimes(GetCurrentThread(), &creation, &exitTime, &kernel, &user);
+        ULARGE_INTEGER k, u;
+        k.LowPart = kernel.dwLowDateTime; k.HighPart = kernel.dwHighDateTime;
+        u.LowPart = user.dwLowDateTime; u.HighPart = user.dwHighDateTime;
+        return (k.QuadPart + u.QuadPart) / 10;
+#else
+        timespec ts;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+        return static_cast<uint64_t>(ts.tv_sec) * 1000000ull + static_cast<uint64_t>(ts.tv_nsec) / 1000ull;
+#endif
+    }
+
+    struct Summary
+    {
+        size_t count = 0;
+        double mean = 0, p50 = 0, p90 = 0, p99 = 0, p999 = 0, max = 0;
+    };
+
+    Summary summarize(std::vector<double> v)
+    {
+        Summary s;
+        s.count = v.size();
+        if (v.empty())
+        {
+            return s;
+        }
+
+        std::sort(v.begin(), v.end());
+        double total = 0;
+        for (double x : v) total += x;
+
+        auto pct = [&](double p)
+        {
+            size_t idx = static_cast<size_t>(p * (v.size() - 1) + 0.5);
+            return v[std::min(idx, v.size() - 1)];
+        };
+
+        s.mean = total / v.size();
+        s.p50 = pct(0.50);
+        s.p90 = pct(0.90);
+        s.p99 = pct(0.99);
+        s.p999 = pct(0.999);
+        s.max = v.back();
+        return s;
+    }
+
+    std::string toJson(const Summary& s)
+    {
+        std::ostringstream o;
+        o << "{\"count\": " << s.count << ", \"mean\": " << s.mean << ", \"p50\": " << s.p50 << ", \"p90\": " << s.p90
+          << ", \"p99\": " << s.p99 << ", \"p999\": " << s.p999 << ", \"max\": " << s.max << "}";
+        return o.str();
+    }
+
+    const char* modeName(SimpleNet::PacketReliability r)
+    {
+        return r == SimpleNet::PacketReliability::Reliable ? "reliable" : "unreliable";
+    }
+
+    //Server side of the bench. Owns the NetServer and only ever touches it from its own thread.
+    class BenchServer
+    {
+    public:
+        std::atomic<bool> running{ true };
+        std::atomic<bool> recordTicks{ false };
+        std::atomic<uint64_t> receivedMessages{ 0 };
+        std::atomic<uint64_t> receivedBytes{ 0 };
+        std::atomic<size_t> connected{ 0 };
+
+        bool start(uint16_t port, uint32_t maxClients, const Options& opt)
+        {
+            server.setCompression(opt.compression);
+            if (opt.model)
+            {
+                server.setCompressionModel(opt.model);
+            }
+            if (!server.create(port, maxClients))
+            {
+                return false;
+            }
+
+            //For the browser probe bench, pings are answered on the game port. The discovery port itself
+            //is off to the side so it doesn't clash with a game running on the same machine.
+            if (!server.enableDiscovery(port + 1))
+            {
+                std::cerr << "Discovery unavailable, browser probes will go unanswered\n";
+            }
+
+            worker = std::thread([this] { loop(); });
+            return true;
+        }
+
+        void stop()
+        {
+            running = false;
+            if (worker.joinable())
+            {
+                worker.join();
+            }
+        }
+
+        //Per-tick samples (cpu us, wall us) recorded while recordTicks is set.
+        void takeTickSamples(std::vector<double>& cpu, std::vector<double>& wall)
+        {
+            std::lock_guard<std::mutex> lock(samplesMutex);
+            cpu.swap(tickCpu);
+            wall.swap(tickWall);
+            tickCpu.clear();
+            tickWall.clear();
+        }
+
+        std::vector<double> takeBroadcastSamples()
+        {
+            std::lock_guard<std::mutex> lock(samplesMutex);
+            std::vector<double> out;
+            out.swap(broadcastCost);
+            return out;
+        }
+
+    private:
+        void loop()
+        {
+            while (running)
+            {
+                uint64_t cpu0 = threadCpuMicros();
+                uint64_t wall0 = nowNs();
+                size_t events = 0;
+
+                server.service(1, [&](const SimpleNet::NetEvent& e)
+                {
+                    ++events;
+                    switch (e.type)
+                    {
+                    case SimpleNet::NetEvent::Connect:
+                    case SimpleNet::NetEvent::Disconnect:
+                    {
+                        connected = server.connectedCount();
+                        break;
+                    }
+                    case SimpleNet::NetEvent::Receive:
+                    {
+                        handleReceive(e);
+                        break;
+                    }
+                    default:
+                    {
+                        break;
+                    }
+                    }
+                });
+
+                //Idle ticks are mostly the 1ms wait, only busy ones say something about CPU cost.
+                if (recordTicks && events > 0)
+                {
+                    double cpu = static_cast<double>(threadCpuMicros() - cpu0);
+                    double wall = static_cast<double>(nowNs() - wall0) / 1000.0;
+                    std::lock_guard<std::mutex> lock(samplesMutex);
+                    tickCpu.push_back(cpu);
+                    tickWall.push_back(wall);
+                }
+            }
+        }
+
+        void handleReceive(const SimpleNet::NetEvent& e)
+        {
+            SimpleNet::PacketReader p(e.packet);
+            uint8_t op = 0, mode = 0;
+            if (!p.readPOD(op) || !p.readPOD(mode))
+            {
+                return;
+            }
+
+            receivedMessages.fetch_add(1, std::memory_order_relaxed);
+            receivedBytes.fetch_add(e.packet.data.size(), std::memory_order_relaxed);
+
+            SimpleNet::PacketReliability r = mode ? SimpleNet::PacketReliability::Reliable : SimpleNet::PacketReliability::Unreliable;
+            if (op == OpEcho)
+            {
+                server.sendTo(e.peerId, e.packet, r, mode ? 0 : 1);
+            }
+            else if (op == OpFanout)
+            {
+                uint64_t t0 = nowNs();
+                server.broadcast(e.packet, r, mode ? 0 : 1);
+                double us = static_cast<double>(nowNs() - t0) / 1000.0;
+
+                std::lock_guard<std::mutex> lock(samplesMutex);
+                broadcastCost.push_back(us);
+            }
+        }
+
+        SimpleNet::NetServer server;
+        std::thread worker;
+
+        std::mutex samplesMutex;
+        std::vector<double> tickCpu;
+        std::vector<double> tickWall;
+        std::vector<double> broadcastCost;
+    };
+
+    SimpleNet::Packet makeMessage(Op op, SimpleNet::PacketReliability r, uint32_t size)
+    {
+        SimpleNet::Packet p;
+        p.appendPOD(static_cast<uint8_t>(op));
+        p.appendPOD(static_cast<uint8_t>(r == SimpleNet::PacketReliability::Reliable ? 1 : 0));
+        p.appendPOD(nowNs());
+
+        //Pad out to the requested payload size.
+        if (p.data.size() < size)
+        {
+            p.data.resize(size, 0xAB);
+        }
+        return p;
+    }
+
+    uint64_t sendTimeOf(const SimpleNet::Packet& received)
+    {
+        SimpleNet::PacketReader p(received);
+        uint8_t op = 0, mode = 0;
+        uint64_t t = 0;
+        p.readPOD(op);
+        p.readPOD(mode);
+        p.readPOD(t);
+        return t;
+    }
+
+    void serviceAll(std::vector<std::unique_ptr<SimpleNet::NetClient>>& clients, const SimpleNet::NetClient::EventCallback& cb)
+    {
+        for (auto& c : clients)
+        {
+            c->service(0, cb);
+        }
+    }
+
+    //Round trip latency of single in-flight echoes from client 0, in microseconds.
+    std::string benchLatency(std::vector<std::unique_ptr<SimpleNet::NetClient>>& clients, const Options& opt, SimpleNet::PacketReliability r)
+    {
+        std::vector<double> rtt;
+        rtt.reserve(opt.samples);
+        uint32_t lost = 0;
+
+        for (uint32_t i = 0; i < opt.samples; ++i)
+        {
+            clients[0]->send(makeMessage(OpEcho, r, opt.payloadSize), r, r == SimpleNet::PacketReliability::Reliable ? 0 : 1);
+
+            bool done = false;
+            Clock::time_point deadline = Clock::now() + std::chrono::seconds(1);
+            while (!done && Clock::now() < deadline)
+            {
+                clients[0]->service(0, [&](const SimpleNet::NetEvent& e)
+                {
+                    if (e.type == SimpleNet::NetEvent::Receive)
+                    {
+                        rtt.push_back(static_cast<double>(nowNs() - sendTimeOf(e.packet)) / 1000.0);
+                        done = true;
+                    }
+                });
+            }
+
+            if (!done)
+            {
+                ++lost;
+            }
+        }
+
+        std::ostringstream o;
+        o << "{\"mode\": \"" << modeName(r) << "\", \"rtt_us\": " << toJson(summarize(rtt)) << ", \"lost\": " << lost << "}";
+        return o.str();
+    }
+
+    //All clients send as fast as the server keeps up, for opt.seconds.
+    std::string benchThroughput(std::vector<std::unique_ptr<SimpleNet::NetClient>>& clients, BenchServer& server, const Options& opt,
+        SimpleNet::PacketReliability r, uint32_t size)
+    {
+        const uint32_t burst = 8;
+        uint64_t sent = 0;
+        int channel = r == SimpleNet::PacketReliability::Reliable ? 0 : 1;
+        SimpleNet::Packet msg = makeMessage(OpSink, r, size);
+
+        //Let the previous phase drain before counting.
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        serviceAll(clients, [](const SimpleNet::NetEvent&) {});
+
+        server.receivedMessages = 0;
+        server.receivedBytes = 0;
+        server.recordTicks = true;
+
+        Clock::time_point start = Clock::now();
+        Clock::time_point end = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(opt.seconds));
+        while (Clock::now() < end)
+        {
+            for (auto& c : clients)
+            {
+                for (uint32_t i = 0; i < burst; ++i)
+                {
+                    c->send(msg, r, channel);
+                    ++sent;
+                }
+            }
+            serviceAll(clients, [](const SimpleNet::NetEvent&) {});
+        }
+
+        double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+        //Give the server a moment to drain what is still in flight.
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        server.recordTicks = false;
+
+        uint64_t msgs = server.receivedMessages;
+        uint64_t bytes = server.receivedBytes;
+
+        std::vector<double> cpu, wall;
+        server.takeTickSamples(cpu, wall);
+
+        std::ostringstream o;
+        o << "{\"mode\": \"" << modeName(r) << "\", \"payload_bytes\": " << size << ", \"seconds\": " << elapsed
+          << ", \"sent\": " << sent << ", \"received\": " << msgs
+          << ", \"messages_per_sec\": " << (msgs / elapsed) << ", \"bytes_per_sec\": " << (bytes / elapsed)
+          << ", \"server_tick_cpu_us\": " << toJson(summarize(cpu)) << ", \"server_tick_wall_us\": " << toJson(summarize(wall)) << "}";
+        return o.str();
+    }
+
+    //Broadcast one reliable message and wait until every connected client has it.
+    std::string benchFanout(std::vector<std::unique_ptr<SimpleNet::NetClient>>& clients, BenchServer& server, const Options& opt)
+    {
+        const uint32_t rounds = std::max<uint32_t>(opt.samples / 10, 20);
+        std::vector<double> complete;
+        complete.reserve(rounds);
+        server.takeBroadcastSamples();
+
+        for (uint32_t i = 0; i < rounds; ++i)
+        {
+            size_t pending = clients.size();
+            uint64_t lastArrival = 0;
+            uint64_t sentAt = nowNs();
+            clients[0]->send(makeMessage(OpFanout, SimpleNet::PacketReliability::Reliable, opt.payloadSize));
+
+            Clock::time_point deadline = Clock::now() + std::chrono::seconds(2);
+            while (pending > 0 && Clock::now() < deadline)
+            {
+                serviceAll(clients, [&](const SimpleNet::NetEvent& e)
+                {
+                    if (e.type == SimpleNet::NetEvent::Receive && pending > 0)
+                    {
+                        --pending;
+                        lastArrival = nowNs();
+                    }
+                });
+            }
+
+            if (pending == 0)
+            {
+                complete.push_back(static_cast<double>(lastArrival - sentAt) / 1000.0);
+            }
+        }
+
+        //Broadcast samples are pushed by the server thread after the send, give it a moment.
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+        std::ostringstream o;
+        o << "{\"peers\": " << clients.size() << ", \"server_broadcast_us\": " << toJson(summarize(server.takeBroadcastSamples()))
+          << ", \"all_received_us\": " << toJson(summarize(complete)) << "}";
+        return o.str();
+    }
+
+    //Same 8 message bursts as the throughput bench, once flushing every send and once leaving it to service().
+    std::string benchFlush(std::vector<std::unique_ptr<SimpleNet::NetClient>>& clients, BenchServer& server, const Options& opt,
+        SimpleNet::FlushPolicy policy)
+    {
+        const uint32_t burst = 8;
+        const SimpleNet::PacketReliability r = SimpleNet::PacketReliability::Unreliable;
+        uint64_t sent = 0;
+        SimpleNet::Packet msg = makeMessage(OpSink, r, opt.payloadSize);
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        serviceAll(clients, [](const SimpleNet::NetEvent&) {});
+
+        uint64_t datagramsBefore = 0;
+        for (auto& c : clients)
+        {
+            c->setFlushPolicy(policy);
+            datagramsBefore += c->ioStats().datagramsSent;
+        }
+        server.receivedMessages = 0;
+
+        Clock::time_point start = Clock::now();
+        Clock::time_point end = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(opt.seconds));
+        while (Clock::now() < end)
+        {
+            for (auto& c : clients)
+            {
+                for (uint32_t i = 0; i < burst; ++i)
+                {
+                    c->send(msg, r, 1);
+                    ++sent;
+                }
+            }
+            serviceAll(clients, [](const SimpleNet::NetEvent&) {});
+        }
+
+        double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+        //Acks and pings are in here too, they are the same for both policies.
+        uint64_t datagrams = 0;
+        for (auto& c : clients)
+        {
+            datagrams += c->ioStats().datagramsSent;
+            c->setFlushPolicy(SimpleNet::FlushPolicy::Immediate);
+        }
+        datagrams -= datagramsBefore;
+
+        uint64_t msgs = server.receivedMessages;
+        std::ostringstream o;
+        o << "{\"policy\": \"" << (policy == SimpleNet::FlushPolicy::Immediate ? "immediate" : "coalesced") << "\", \"sent\": " << sent
+          << ", \"received\": " << msgs << ", \"client_datagrams\": " << datagrams
+          << ", \"datagrams_per_message\": " << (sent ? static_cast<double>(datagrams) / sent : 0.0)
+          << ", \"messages_per_sec\": " << (msgs / elapsed) << "}";
+        return o.str();
+    }
+
+    //A server browser pinging 64 candidates (all the bench server) and how many syscalls that took.
+    std::string benchBrowser(const Options& opt)
+    {
+        const uint32_t candidates = 64;
+        const uint32_t probes = 4;
+
+        SimpleNet::ServerBrowser browser;
+        ENetAddress address;
+        enet_address_set_host_ip(&address, "127.0.0.1");
+        address.port = opt.port;
+        for (uint32_t i = 0; i < candidates; ++i)
+        {
+            browser.addCandidate(address);
+        }
+
+        SimpleNet::DatagramBatch::Stats before = SimpleNet::DatagramBatch::stats();
+        uint64_t t0 = nowNs();
+        std::vector<SimpleNet::BrowseResult> results = browser.rank(1000, probes, 20);
+        double ms = static_cast<double>(nowNs() - t0) / 1e6;
+        SimpleNet::DatagramBatch::Stats after = SimpleNet::DatagramBatch::stats();
+
+        std::vector<double> rtt;
+        for (const SimpleNet::BrowseResult& b : results)
+        {
+            if (b.reachable)
+            {
+                rtt.push_back(b.rttMs * 1000.0);
+            }
+        }
+
+        //Receive calls aren't reported, the server thread polls its discovery socket through DatagramBatch every tick.
+        uint64_t datagrams = after.datagramsSent - before.datagramsSent;
+        uint64_t sendCalls = after.sendCalls - before.sendCalls;
+        std::ostringstream o;
+        o << "{\"candidates\": " << candidates << ", \"probes_per_candidate\": " << probes << ", \"reachable\": " << rtt.size()
+          << ", \"rank_ms\": " << ms << ", \"probe_datagrams\": " << datagrams << ", \"send_calls\": " << sendCalls
+          << ", \"pong_datagrams\": " << (after.datagramsReceived - before.datagramsReceived)
+          << ", \"rtt_us\": " << toJson(summarize(rtt)) << "}";
+        return o.str();
+    }
+
+    bool connectClients(std::vector<std::unique_ptr<SimpleNet::NetClient>>& clients, BenchServer& server, const Options& opt, size_t count)
+    {
+        while (clients.size() < count)
+        {
+            auto c = std::make_unique<SimpleNet::NetClient>();
+            c->setCompression(opt.compression);
+            if (opt.model)
+            {
+                c->setCompressionModel(opt.model);
+            }
+            if (!c->connect("127.0.0.1", opt.port, 2000))
+            {
+                std::cerr << "Client " << clients.size() << " failed to connect\n";
+                return false;
+            }
+            clients.push_back(std::move(c));
+        }
+
+        //Wait for the server thread to register everyone.
+        Clock::time_point deadline = Clock::now() + std::chrono::seconds(2);
+        while (server.connected < count && Clock::now() < deadline)
+        {
+            serviceAll(clients, [](const SimpleNet::NetEvent&) {});
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return server.connected >= count;
+    }
+
+    bool parseArgs(int argc, char** argv, Options& opt)
+    {
+        for (int i = 1; i < argc; ++i)
+        {
+            std::string a = argv[i];
+            bool hasValue = i + 1 < argc;
+
+            if (a == "--clients" && hasValue) opt.clients = static_cast<uint32_t>(std::atoi(argv[++i]));
+            else if (a == "--port" && hasValue) opt.port = static_cast<uint16_t>(std::atoi(argv[++i]));
+            else if (a == "--seconds" && hasValue) opt.seconds = std::atof(argv[++i]);
+            else if (a == "--samples" && hasValue) opt.samples = static_cast<uint32_t>(std::atoi(argv[++i]));
+            else if (a == "--size" && hasValue) opt.payloadSize = static_cast<uint32_t>(std::atoi(argv[++i]));
+            else if (a == "--out" && hasValue) opt.outPath = argv[++i];
+            else if (a == "--model" && hasValue)
+            {
+                opt.model = SimpleNet::TrainedModel::load(argv[++i]);
+                if (!opt.model)
+                {
+                    return false;
+                }
+            }
+            else if (a == "--compression" && hasValue)
+            {
+                std::string mode = argv[++i];
+                if (mode == "none") opt.compression = SimpleNet::Compression::None;
+                else if (mode == "range") opt.compression = SimpleNet::Compression::RangeCoder;
+                else if (mode == "lz") opt.compression = SimpleNet::Compression::Lz;
+                else if (mode == "trained") opt.compression = SimpleNet::Compression::Trained;
+                else
+                {
+                    std::cerr << "Unknown compression " << mode << "\n";
+                    return false;
+                }
+            }
+            else
+            {
+                std::cerr << "Usage: LoopbackBench [--clients N] [--port P] [--seconds S] [--samples K] [--size BYTES] [--compression none|range|lz|trained] [--model FILE] [--out FILE]\n";
+                return false;
+            }
+        }
+
+        if (opt.compression == SimpleNet::Compression::Trained && !opt.model)
+        {
+            std::cerr << "--compression trained needs --model\n";
+            return false;
+        }
+
+        opt.clients = std::max<uint32_t>(opt.clients, 1);
+        opt.samples = std::max<uint32_t>(opt.samples, 1);
+        return true;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    Options opt;
+    if (!parseArgs(argc, argv, opt))
+    {
+        return 1;
+    }
+
+    if (!SimpleNet::Net::Initialize())
+    {
+        return 1;
+    }
+
+    int rc = 0;
+    {
+        BenchServer server;
+        if (!server.start(opt.port, opt.clients + 1, opt))
+        {
+            SimpleNet::Net::Deinitialize();
+            return 1;
+        }
+
+        std::vector<std::unique_ptr<SimpleNet::NetClient>> clients;
+        std::vector<std::string> fanout;
+
+        //Fan-out is measured while ramping up the peer count, 1, 2, 4, ... N.
+        for (size_t peers = 1; ; peers = std::min<size_t>(peers * 2, opt.clients))
+        {
+            if (!connectClients(clients, server, opt, peers))
+            {
+                rc = 1;
+                break;
+            }
+
+            std::cerr << "fan-out with " << peers << " peers\n";
+            fanout.push_back(benchFanout(clients, server, opt));
+
+            if (peers == opt.clients)
+            {
+                break;
+            }
+        }
+
+        if (rc == 0)
+        {
+            std::vector<std::string> latency;
+            std::vector<std::string> throughput;
+            const SimpleNet::PacketReliability modes[] = { SimpleNet::PacketReliability::Reliable, SimpleNet::PacketReliability::Unreliable };
+
+            for (SimpleNet::PacketReliability r : modes)
+            {
+                std::cerr << "latency (" << modeName(r) << ")\n";
+                latency.push_back(benchLatency(clients, opt, r));
+            }
+
+            SimpleNet::HostBatching::Stats ioBefore = SimpleNet::HostBatching::stats();
+            for (SimpleNet::PacketReliability r : modes)
+            {
+                std::cerr << "throughput (" << modeName(r) << ")\n";
+                throughput.push_back(benchThroughput(clients, server, opt, r, opt.payloadSize));
+                throughput.push_back(benchThroughput(clients, server, opt, r, 1024));
+            }
+            SimpleNet::HostBatching::Stats ioAfter = SimpleNet::HostBatching::stats();
+
+            std::vector<std::string> flush;
+            for (SimpleNet::FlushPolicy policy : { SimpleNet::FlushPolicy::Immediate, SimpleNet::FlushPolicy::Coalesced })
+            {
+                std::cerr << "flush (" << (policy == SimpleNet::FlushPolicy::Immediate ? "immediate" : "coalesced") << ")\n";
+                flush.push_back(benchFlush(clients, server, opt, policy));
+            }
+
+            std::cerr << "browser probes\n";
+            std::string browser = benchBrowser(opt);
+
+            auto join = [](const std::vector<std::string>& v)
+            {
+                std::string s;
+                for (size_t i = 0; i < v.size(); ++i)
+                {
+                    s += (i ? ",\n    " : "\n    ") + v[i];
+                }
+                return s + "\n  ";
+            };
+
+            std::ostringstream json;
+            json << "{\n  \"benchmark\": \"loopback\",\n  \"clients\": " << opt.clients << ",\n  \"payload_bytes\": " << opt.payloadSize
+                 << ",\n  \"latency\": [" << join(latency) << "],\n  \"throughput\": [" << join(throughput)
+                 << "],\n  \"fanout\": [" << join(fanout) << "],\n  \"flush\": [" << join(flush)
+                 << "],\n  \"browser\": " << browser;
+
+            //Server and client hosts together, over the throughput runs only.
+            uint64_t ioSent = ioAfter.datagramsSent - ioBefore.datagramsSent;
+            uint64_t ioSendCalls = ioAfter.sendCalls - ioBefore.sendCalls;
+            uint64_t ioReceived = ioAfter.datagramsReceived - ioBefore.datagramsReceived;
+            uint64_t ioReceiveCalls = ioAfter.receiveCalls - ioBefore.receiveCalls;
+            json << ",\n  \"host_io\": {\"batching\": " << (SimpleNet::HostBatching::Available ? "true" : "false")
+                 << ", \"datagrams_sent\": " << ioSent << ", \"send_syscalls\": " << ioSendCalls
+                 << ", \"send_syscalls_per_datagram\": " << (ioSent ? double(ioSendCalls) / ioSent : 0.0)
+                 << ", \"datagrams_received\": " << ioReceived << ", \"receive_syscalls\": " << ioReceiveCalls
+                 << ", \"receive_syscalls_per_datagram\": " << (ioReceived ? double(ioReceiveCalls) / ioReceived : 0.0)
+                 << ", \"send_errors\": " << (ioAfter.sendErrors - ioBefore.sendErrors) << "}";
+
+            SimpleNet::AllocatorStats alloc = SimpleNet::Net::GetAllocatorStats();
+            json << ",\n  \"allocator\": {\"live_bytes\": " << alloc.liveBytes << ", \"peak_bytes\": " << alloc.peakBytes
+                 << ", \"allocations\": " << alloc.allocations << ", \"system_allocations\": " << alloc.systemAllocations << "}";
+
+            //Client side only, the server's host belongs to its thread.
+            SimpleNet::CompressionStats comp;
+            for (auto& c : clients)
+            {
+                SimpleNet::CompressionStats cs = c->compressionStats();
+                comp.datagrams += cs.datagrams;
+                comp.compressed += cs.compressed;
+                comp.skipped += cs.skipped;
+                comp.bytesIn += cs.bytesIn;
+                comp.bytesOut += cs.bytesOut;
+                comp.compressNs += cs.compressNs;
+                comp.decompressed += cs.decompressed;
+                comp.decompressNs += cs.decompressNs;
+            }
+            uint64_t tried = comp.datagrams - comp.skipped;
+            json << ",\n  \"compression\": {\"datagrams\": " << comp.datagrams << ", \"compressed\": " << comp.compressed
+                 << ", \"skipped\": " << comp.skipped << ", \"ratio\": " << comp.ratio()
+                 << ", \"compress_ns_per_datagram\": " << (tried ? comp.compressNs / tried : 0)
+                 << ", \"decompress_ns_per_datagram\": " << (comp.decompressed ? comp.decompressNs / comp.decompressed : 0) << "}\n}\n";
+
+            if (opt.outPath.empty())
+            {
+                std::cout << json.str();
+            }
+            else
+            {
+                std::ofstream out(opt.outPath);
+                out << json.str();
+            }
+        }
+
+        for (auto& c : clients)
+        {
+            c->disconnect();
+            c->service(0, [](const SimpleNet::NetEvent&) {});
+        }
+        clients.clear();
+        server.stop();
+    }
+
+    SimpleNet::Net::Deinitialize();
+    return rc;
+}
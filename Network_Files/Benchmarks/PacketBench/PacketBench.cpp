@@ -0,0 +1,399 @@
+// PacketBench: microbenchmarks for Packet serialization.
+//
+// Covers the message shapes the library actually sees: small POD, string heavy,
+// large arrays and a mix. Every writer/reader variant reports ns/op, bytes/op,
+// allocations/op and allocated bytes/op. Allocations are counted through a
+// global operator new hook.
+//
+// New writers or readers get compared against the std::vector::insert path by
+// adding a variant to the tables in main(). The checksum_* rows time the
+// CRC-32C datagram checksum paths.
+//
+// Usage: PacketBench [--iterations N] [--out FILE]
+
+#include "SimpleNet.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+//Allocation counting hook. Counted for every thread, benchmarks run on one.
+static std::atomic<uint64_t> g_allocCount{ 0 };
+static std::atomic<uint64_t> g_allocBytes{ 0 };
+
+void* operator new(size_t size)
+{
+    g_allocCount.fetch_add(1, std::memory_order_relaxed);
+    g_allocBytes.fetch_add(size, std::memory_order_relaxed);
+
+    if (void* p = std::malloc(size ? size : 1))
+    {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size)
+{
+    return ::operator new(size);
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept
+{
+    std::free(p);
+}
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    //Keeps the optimizer from throwing benchmark work away.
+    volatile uint64_t g_sink = 0;
+
+    struct Result
+    {
+        std::string shape;
+        std::string variant;
+        double nsPerOp = 0;
+        double bytesPerOp = 0;
+        double allocsPerOp = 0;
+        double allocBytesPerOp = 0;
+    };
+
+    //Input data for the message shapes.
+    struct Fixture
+    {
+        std::vector<std::string> names;
+        std::vector<float> samples;
+
+        Fixture()
+        {
+            names = { "player_one", "a slightly longer chat message that will not fit in SSO", "ok", "inventory:sword_of_a_thousand_truths" };
+            samples.resize(1024);
+            for (size_t i = 0; i < samples.size(); ++i)
+            {
+                samples[i] = static_cast<float>(i) * 0.5f;
+            }
+        }
+    };
+
+    //Message shapes, written through any writer exposing appendPOD/appendString/appendBytes.
+    template<typename Writer>
+    void writeSmallPod(Writer& w, const Fixture&, uint32_t i)
+    {
+        w.appendPOD(i);
+        w.appendPOD(static_cast<float>(i) * 1.5f);
+        w.appendPOD(static_cast<float>(i) * 2.5f);
+    }
+
+    template<typename Writer>
+    void writeStringHeavy(Writer& w, const Fixture& f, uint32_t)
+    {
+        for (const std::string& s : f.names)
+        {
+            w.appendString(s);
+        }
+    }
+
+    template<typename Writer>
+    void writeLargeArray(Writer& w, const Fixture& f, uint32_t)
+    {
+        uint32_t count = static_cast<uint32_t>(f.samples.size());
+        w.appendPOD(count);
+        w.appendBytes(f.samples.data(), f.samples.size() * sizeof(float));
+    }
+
+    template<typename Writer>
+    void writeMixed(Writer& w, const Fixture& f, uint32_t i)
+    {
+        w.appendPOD(static_cast<uint8_t>(7));
+        w.appendPOD(i);
+        w.appendString(f.names[0]);
+        for (uint32_t k = 0; k < 16; ++k)
+        {
+            w.appendPOD(static_cast<float>(k + i));
+        }
+        w.appendString(f.names[2]);
+    }
+
+    using WriteFn = void (*)(SimpleNet::Packet&, const Fixture&, uint32_t);
+    using ReadFn = bool (*)(SimpleNet::Packet&, std::string&);
+    using ReaderFn = bool (*)(SimpleNet::PacketReader&, std::string&);
+
+    struct Shape
+    {
+        const char* name;
+        WriteFn write;
+        ReadFn read;
+        ReaderFn readReader;
+        ReaderFn readReaderViews;
+        size_t reserveHint;
+    };
+
+    template<typename Fn>
+    Result measure(const char* shape, const char* variant, uint32_t iterations, Fn&& fn)
+    {
+        //Warm up so first-touch costs do not land in the numbers.
+        uint64_t bytes = 0;
+        for (uint32_t i = 0; i < iterations / 10 + 1; ++i)
+        {
+            bytes += fn(i);
+        }
+
+        bytes = 0;
+        uint64_t allocs0 = g_allocCount.load();
+        uint64_t allocBytes0 = g_allocBytes.load();
+        Clock::time_point t0 = Clock::now();
+
+        for (uint32_t i = 0; i < iterations; ++i)
+        {
+            bytes += fn(i);
+        }
+
+        Clock::time_point t1 = Clock::now();
+        uint64_t allocs = g_allocCount.load() - allocs0;
+        uint64_t allocBytes = g_allocBytes.load() - allocBytes0;
+        g_sink = g_sink + bytes;
+
+        Result r;
+        r.shape = shape;
+        r.variant = variant;
+        r.nsPerOp = std::chrono::duration<double, std::nano>(t1 - t0).count() / iterations;
+        r.bytesPerOp = static_cast<double>(bytes) / iterations;
+        r.allocsPerOp = static_cast<double>(allocs) / iterations;
+        r.allocBytesPerOp = static_cast<double>(allocBytes) / iterations;
+        return r;
+    }
+
+    //Readers matching the write functions above, field by field. Work with Packet and PacketReader,
+    //Views switches strings and arrays to the non-allocating readStringView/readSpan calls.
+    template<typename Reader, bool Views = false>
+    bool readString(Reader& r, std::string& scratch)
+    {
+        if constexpr (Views)
+        {
+            std::string_view view;
+            return r.readStringView(view);
+        }
+        else
+        {
+            return r.readString(scratch);
+        }
+    }
+
+    template<typename Reader, bool Views = false>
+    bool readSmallPod(Reader& p, std::string&)
+    {
+        uint32_t id; float x, y;
+        return p.readPOD(id) && p.readPOD(x) && p.readPOD(y);
+    }
+
+    template<typename Reader, bool Views = false>
+    bool readStringHeavy(Reader& p, std::string& scratch)
+    {
+        for (int k = 0; k < 4; ++k)
+        {
+            if (!readString<Reader, Views>(p, scratch)) return false;
+        }
+        return true;
+    }
+
+    template<typename Reader, bool Views = false>
+    bool readLargeArray(Reader& p, std::string&)
+    {
+        uint32_t count = 0;
+        if (!p.readPOD(count)) return false;
+
+        if constexpr (Views)
+        {
+            SimpleNet::ByteSpan span;
+            return p.readSpan(count * sizeof(float), span);
+        }
+        else
+        {
+            std::vector<float> out(count);
+            return p.readBytes(out.data(), count * sizeof(float));
+        }
+    }
+
+    template<typename Reader, bool Views = false>
+    bool readMixed(Reader& p, std::string& scratch)
+    {
+        uint8_t tag; uint32_t id; float v;
+        if (!p.readPOD(tag) || !p.readPOD(id) || !readString<Reader, Views>(p, scratch)) return false;
+        for (int k = 0; k < 16; ++k)
+        {
+            if (!p.readPOD(v)) return false;
+        }
+        return readString<Reader, Views>(p, scratch);
+    }
+
+    std::string toJson(const std::vector<Result>& results, uint32_t iterations)
+    {
+        std::ostringstream o;
+        o << "{\n  \"benchmark\": \"packet\",\n  \"iterations\": " << iterations << ",\n  \"results\": [";
+        for (size_t i = 0; i < results.size(); ++i)
+        {
+            const Result& r = results[i];
+            o << (i ? ",\n    " : "\n    ")
+              << "{\"shape\": \"" << r.shape << "\", \"variant\": \"" << r.variant << "\", \"ns_per_op\": " << r.nsPerOp
+              << ", \"bytes_per_op\": " << r.bytesPerOp << ", \"allocs_per_op\": " << r.allocsPerOp
+              << ", \"alloc_bytes_per_op\": " << r.allocBytesPerOp << "}";
+        }
+        o << "\n  ]\n}\n";
+        return o.str();
+    }
+}
+
+int main(int argc, char** argv)
+{
+    uint32_t iterations = 200000;
+    std::string outPath;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string a = argv[i];
+        if (a == "--iterations" && i + 1 < argc) iterations = static_cast<uint32_t>(std::atoi(argv[++i]));
+        else if (a == "--out" && i + 1 < argc) outPath = argv[++i];
+        else
+        {
+            std::cerr << "Usage: PacketBench [--iterations N] [--out FILE]\n";
+            return 1;
+        }
+    }
+    if (iterations == 0)
+    {
+        iterations = 1;
+    }
+
+    Fixture fixture;
+    const Shape shapes[] =
+    {
+        { "small_pod", &writeSmallPod<SimpleNet::Packet>, &readSmallPod<SimpleNet::Packet>, &readSmallPod<SimpleNet::PacketReader>, &readSmallPod<SimpleNet::PacketReader, true>, 12 },
+        { "string_heavy", &writeStringHeavy<SimpleNet::Packet>, &readStringHeavy<SimpleNet::Packet>, &readStringHeavy<SimpleNet::PacketReader>, &readStringHeavy<SimpleNet::PacketReader, true>, 160 },
+        { "large_array", &writeLargeArray<SimpleNet::Packet>, &readLargeArray<SimpleNet::Packet>, &readLargeArray<SimpleNet::PacketReader>, &readLargeArray<SimpleNet::PacketReader, true>, 4100 },
+        { "mixed", &writeMixed<SimpleNet::Packet>, &readMixed<SimpleNet::Packet>, &readMixed<SimpleNet::PacketReader>, &readMixed<SimpleNet::PacketReader, true>, 96 },
+    };
+
+    std::vector<Result> results;
+    for (const Shape& s : shapes)
+    {
+        //Current path: a fresh Packet growing through std::vector::insert.
+        results.push_back(measure(s.name, "write_insert", iterations, [&](uint32_t i)
+        {
+            SimpleNet::Packet p;
+            s.write(p, fixture, i);
+            return p.data.size();
+        }));
+
+        //Same writer, but with the final size reserved up front.
+        results.push_back(measure(s.name, "write_insert_reserved", iterations, [&](uint32_t i)
+        {
+            SimpleNet::Packet p;
+            p.data.reserve(s.reserveHint);
+            s.write(p, fixture, i);
+            return p.data.size();
+        }));
+
+        //Same writer reusing one Packet, the best case for the vector path.
+        SimpleNet::Packet reused;
+        results.push_back(measure(s.name, "write_insert_reused", iterations, [&](uint32_t i)
+        {
+            reused.data.clear();
+            s.write(reused, fixture, i);
+            return reused.data.size();
+        }));
+
+        //Reading as receive handlers do today: copy the event packet, then read.
+        SimpleNet::Packet source;
+        s.write(source, fixture, 1);
+        std::string scratch;
+        results.push_back(measure(s.name, "read_copy", iterations, [&](uint32_t)
+        {
+            SimpleNet::Packet p = source;
+            return s.read(p, scratch) ? p.data.size() : 0;
+        }));
+
+        //Reading in place by rewinding the cursor.
+        results.push_back(measure(s.name, "read_in_place", iterations, [&](uint32_t)
+        {
+            source.cursor = 0;
+            return s.read(source, scratch) ? source.data.size() : 0;
+        }));
+
+        //PacketReader over the const packet, strings copied out.
+        const SimpleNet::Packet& constSource = source;
+        results.push_back(measure(s.name, "read_reader", iterations, [&](uint32_t)
+        {
+            SimpleNet::PacketReader r(constSource);
+            return s.readReader(r, scratch) ? constSource.data.size() : 0;
+        }));
+
+        //PacketReader with readStringView/readSpan, no allocations at all.
+        results.push_back(measure(s.name, "read_reader_views", iterations, [&](uint32_t)
+        {
+            SimpleNet::PacketReader r(constSource);
+            return s.readReaderViews(r, scratch) ? constSource.data.size() : 0;
+        }));
+    }
+
+    //Datagram checksums: the slicing-by-8 fallback against the SSE4.2 path, at game and MTU sizes.
+    std::vector<uint8_t> datagram(1400);
+    for (size_t i = 0; i < datagram.size(); ++i)
+    {
+        datagram[i] = static_cast<uint8_t>(i * 31 + 7);
+    }
+    for (size_t size : { size_t(64), size_t(1400) })
+    {
+        std::string shape = "checksum_" + std::to_string(size);
+        results.push_back(measure(shape.c_str(), "crc32c_slicing8", iterations, [&](uint32_t i)
+        {
+            g_sink = g_sink + SimpleNet::Crc32c::software(i, datagram.data(), size);
+            return size;
+        }));
+#ifdef SIMPLENET_X86
+        if (SimpleNet::Crc32c::hardwareAccelerated())
+        {
+            results.push_back(measure(shape.c_str(), "crc32c_sse42", iterations, [&](uint32_t i)
+            {
+                g_sink = g_sink + SimpleNet::Crc32c::hardware(i, datagram.data(), size);
+                return size;
+            }));
+        }
+#endif
+    }
+
+    std::string json = toJson(results, iterations);
+    if (outPath.empty())
+    {
+        std::cout << json;
+    }
+    else
+    {
+        std::ofstream out(outPath);
+        out << json;
+    }
+
+    return 0;
+}
@@ -0,0 +1,277 @@
+// DedicatedServer: the MultiplayerTestGame server without a window.
+//
+// Runs the same server side as Game with runAsServer=true (movement relay, discovery) but only
+// needs SimpleNet.h and the ENet lib, so no SFML, no GPU context and no rendering. Several can
+// run on one machine as long as each gets its own port.
+//
+// Ticks are driven by SimpleNet::TickScheduler. Every simulation tick (--tick) handles what came in,
+// changed positions go out at --send-rate (the tick rate by default). Ticks that run long are caught
+// up, up to MaxCatchUpTicks in a row, and reported.
+//
+// Usage: DedicatedServer [--port P] [--tick HZ] [--send-rate HZ] [--max-clients N] [--spin-us US]
+//                        [--no-discovery]
+
+#include "SimpleNet.h"
+#include "../MultiplayerTestGame/GameProtocol.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <ctime>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    constexpr uint32_t MaxCatchUpTicks = 5;
+
+    struct Options
+    {
+        uint16_t port = 7777;
+        uint32_t tickRate = TICK_RATE;
+        uint32_t sendRate = 0;
+        uint32_t maxClients = 32;
+        uint32_t spinUs = 500;  //Low, spinning is CPU the other servers on the machine could use
+        bool discovery = true;
+    };
+
+    bool parseArgs(int argc, char** argv, Options& opt)
+    {
+        for (int i = 1; i < argc; ++i)
+        {
+            std::string a = argv[i];
+            bool hasValue = i + 1 < argc;
+
+            if (a == "--port" && hasValue) opt.port = static_cast<uint16_t>(std::atoi(argv[++i]));
+            else if (a == "--tick" && hasValue) opt.tickRate = static_cast<uint32_t>(std::atoi(argv[++i]));
+            else if (a == "--send-rate" && hasValue) opt.sendRate = static_cast<uint32_t>(std::atoi(argv[++i]));
+            else if (a == "--spin-us" && hasValue) opt.spinUs = static_cast<uint32_t>(std::atoi(argv[++i]));
+            else if (a == "--max-clients" && hasValue) opt.maxClients = static_cast<uint32_t>(std::atoi(argv[++i]));
+            else if (a == "--no-discovery") opt.discovery = false;
+            else
+            {
+                std::cerr << "Usage: DedicatedServer [--port P] [--tick HZ] [--send-rate HZ] [--max-clients N] [--spin-us US] [--no-discovery]\n";
+                return false;
+            }
+        }
+
+        if (opt.tickRate == 0 || opt.tickRate > 1000 || opt.sendRate > 1000 || opt.maxClients == 0)
+        {
+            std::cerr << "--tick and --send-rate must be 1-1000 and --max-clients at least 1\n";
+            return false;
+        }
+        return true;
+    }
+
+    //Cleared by Ctrl+C (or SIGTERM) so the server shuts down and clients get a proper disconnect.
+    std::atomic<bool> g_running{ true };
+
+    void onSignal(int)
+    {
+        g_running = false;
+    }
+
+    class DedicatedServer
+    {
+    public:
+        bool start(const Options& opt)
+        {
+            //Same limits as the game's server.
+            SimpleNet::BandwidthLimits limits;
+            limits.perPeer = 64 * 1024;
+            server.setBandwidthLimits(limits);
+            server.setInboundLimits(clientInboundLimits());
+
+            if (!server.create(opt.port, opt.maxClients, gameChannels()))
+            {
+                std::cerr << "Failed to start server on port " << opt.port << "\n";
+                return false;
+            }
+
+            server.setServerInfo(static_cast<uint16_t>(opt.tickRate), 0);
+            if (opt.discovery && !server.enableDiscovery())
+            {
+                std::cerr << "LAN discovery unavailable, clients will need the address\n";
+            }
+
+            std::cout << "Server started on port " << opt.port << " at " << opt.tickRate << " ticks/s\n";
+            return true;
+        }
+
+        //One simulation step, what arrived since the last one. A flood is spread over several ticks
+        //rather than letting one tick run long.
+        void simulate(const SimpleNet::ServiceOptions& limits)
+        {
+            server.service(limits, [&](const SimpleNet::NetEvent& e)
+            {
+                switch (e.type)
+                {
+                case SimpleNet::NetEvent::Connect:
+                {
+                    std::cout << "Client " << e.peerId << " connected\n";
+
+                    //Random starting position, as the game does it.
+                    players[e.peerId] = NetPosition{ static_cast<float>(rand() % (WORLD_WIDTH - 40)), static_cast<float>(rand() % (WORLD_HEIGHT - 40)) };
+
+                    //Sending everyone's position again so the new client sees players who are standing still.
+                    stateOut.resendAll();
+                    break;
+                }
+                case SimpleNet::NetEvent::Disconnect:
+                {
+                    std::cout << "Client " << e.peerId << " disconnected\n";
+                    players.erase(e.peerId);
+                    stateIn.forgetSource(e.peerId);
+                    stateOut.removeEntity(e.peerId);
+                    break;
+                }
+                case SimpleNet::NetEvent::Receive:
+                {
+                    if (e.channel != static_cast<uint8_t>(GameChannel::Movement))
+                    {
+                        break;
+                    }
+
+                    stateIn.apply(e.peerId, e.packet, [&](uint32_t, uint16_t property, SimpleNet::PacketReader& value)
+                    {
+                        NetPosition pos;
+                        if (property != PlayerPosition || !value.readPOD(pos))
+                        {
+                            return;
+                        }
+
+                        if (players.count(e.peerId))
+                        {
+                            players[e.peerId] = pos;
+                        }
+                        stateOut.set(e.peerId, PlayerPosition, pos);
+                    });
+                    break;
+                }
+                default:
+                {
+                    break;
+                }
+                }
+            });
+        }
+
+        //Positions that changed since the last send, within what the clients' links take per send tick.
+        void sendUpdates(uint32_t periodMs)
+        {
+            SimpleNet::Packet packet;
+            if (stateOut.flush(packet, std::min<size_t>(server.broadcastBudget(periodMs), 1200)))
+            {
+                server.broadcast(packet, GameChannel::Movement);
+            }
+        }
+
+        //Advertised to discovery so browsers can prefer a quieter server. 255 is a tick using all of its time.
+        void reportLoad(uint32_t tickRate, double busyFraction)
+        {
+            server.setServerInfo(static_cast<uint16_t>(tickRate), static_cast<uint8_t>(std::min(busyFraction, 1.0) * 255.0));
+        }
+
+        const SimpleNet::ServiceStats& serviceStats() const { return server.serviceStats(); }
+        const SimpleNet::RateLimitStats& rateLimitStats() const { return server.rateLimitStats(); }
+
+        void shutdown()
+        {
+            std::vector<uint32_t> ids;
+            for (const auto& kv : players)
+            {
+                ids.push_back(kv.first);
+            }
+            for (uint32_t id : ids)
+            {
+                server.disconnect(id);
+            }
+
+            //A moment for the disconnects to go out.
+            server.service(100, [](const SimpleNet::NetEvent&) {});
+        }
+
+    private:
+        SimpleNet::NetServer server;
+        SimpleNet::StateSender stateOut;
+        SimpleNet::StateReceiver stateIn;
+        std::map<uint32_t, NetPosition> players;
+    };
+}
+
+int main(int argc, char** argv)
+{
+    Options opt;
+    if (!parseArgs(argc, argv, opt))
+    {
+        return 1;
+    }
+
+    std::srand(static_cast<unsigned>(std::time(nullptr)));
+    std::signal(SIGINT, onSignal);
+    std::signal(SIGTERM, onSignal);
+
+    if (!SimpleNet::Net::Initialize())
+    {
+        return 1;
+    }
+
+    int result = 0;
+    {
+        DedicatedServer game;
+        if (!game.start(opt))
+        {
+            result = 1;
+        }
+        else
+        {
+            SimpleNet::TickRates rates;
+            rates.simulationHz = opt.tickRate;
+            rates.networkHz = opt.sendRate;
+            rates.maxCatchUp = MaxCatchUpTicks;
+            rates.spinUs = opt.spinUs;
+            SimpleNet::TickScheduler ticks(rates);
+
+            ticks.onOverrun([](const SimpleNet::TickOverrun& o)
+            {
+                std::cerr << "Tick " << o.simulationTick << " took " << o.workMs << " ms (budget " << o.budgetMs << " ms)\n";
+            });
+
+            SimpleNet::ServiceOptions serviceLimits;
+            serviceLimits.budgetUs = 1000000 / opt.tickRate / 2;
+
+            Clock::time_point nextReport = Clock::now() + std::chrono::seconds(1);
+            double workAtReport = 0.0;
+
+            while (g_running)
+            {
+                ticks.step([&](double) { game.simulate(serviceLimits); },
+                           [&]() { game.sendUpdates(ticks.networkPeriodMs()); });
+
+                //Share of the last second spent working, for discovery.
+                if (Clock::now() >= nextReport)
+                {
+                    nextReport += std::chrono::seconds(1);
+                    game.reportLoad(opt.tickRate, ticks.stats().totalWorkSeconds - workAtReport);
+                    workAtReport = ticks.stats().totalWorkSeconds;
+                }
+            }
+
+            const SimpleNet::TickStats& stats = ticks.stats();
+            std::cout << "Shutting down after " << stats.simulationTicks << " ticks (" << stats.overruns << " overran, "
+                      << stats.droppedTicks << " dropped, worst " << stats.worstWorkMs << " ms, "
+                      << game.serviceStats().deferredEvents << " events deferred to a later tick, "
+                      << game.rateLimitStats().dropped << " dropped by inbound limits)\n";
+            game.shutdown();
+        }
+    }
+
+    SimpleNet::Net::Deinitialize();
+    return result;
+}
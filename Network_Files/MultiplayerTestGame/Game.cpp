@@ -1,11 +1,8 @@
 ﻿#include "Game.h"
 #include <thread>
-#include <fstream>
 
-static constexpr uint32_t NETWORK_TICK_MS = 16; //This is the tick. I think this is roughly 60fps?
-
-Game::Game(bool runAsServer, uint16_t port)
-    : window(sf::VideoMode(sf::Vector2u(800, 600)), runAsServer ? "Server" : "Client"),localPlayer(400.f, 300.f),
+Game::Game(bool runAsServer, uint16_t port, const std::string& host)
+    : window(sf::VideoMode(sf::Vector2u(WORLD_WIDTH, WORLD_HEIGHT)), runAsServer ? "Server" : "Client"),ticks(TICK_RATE),localPlayer(400.f, 300.f),
     isServer(runAsServer),isRunning(true),serverPort(port)
 {
     SimpleNet::Net::Initialize();
@@ -13,8 +10,14 @@ Game::Game(bool runAsServer, uint16_t port)
     if (isServer) 
     {
         server = std::make_unique<SimpleNet::NetServer>();
+
+        //Keeping each client's share modest, anything over it is left for the next tick.
+        SimpleNet::BandwidthLimits limits;
+        limits.perPeer = 64 * 1024;
+        server->setBandwidthLimits(limits);
+        server->setInboundLimits(clientInboundLimits());
         //Faile safe stuff
-        if (!server->create(port, 32)) 
+        if (!server->create(port, 32, gameChannels())) 
         {
             std::cerr << "Failed to start server on port " << port << "\n";
             isRunning = false;
@@ -26,27 +29,25 @@ Game::Game(bool runAsServer, uint16_t port)
             //Defaulting server "local plauer" as a red circle.
             localPlayer.shape.setFillColor(sf::Color::Red);
 
-            //Write server port to registry file
-            std::ofstream out("servers.txt", std::ios::app);
-            if (out.is_open()) 
-            {
-                out << port << "\n";
-                out.close();
-            }
+            //Let clients on the LAN find this server.
+            server->setServerInfo(static_cast<uint16_t>(TICK_RATE), 0);
+            server->enableDiscovery();
         }
     }
     else 
     {
         //Making client and placing them to a server.
+        //Connecting happens in the background, handleNetwork gets told how it went.
         client = std::make_unique<SimpleNet::NetClient>();
-        if (!client->connect("localhost", port)) 
+        client->setChannelLayout(gameChannels());
+        if (client->connectAsync(host, port) == 0) 
         {
             std::cerr << "Failed to connect to server\n";
             isRunning = false;
         }
         else 
         {
-            std::cout << "Connected to server on port " << port << "\n";
+            std::cout << "Connecting to server on port " << port << "...\n";
         }
     }
 
@@ -54,18 +55,22 @@ Game::Game(bool runAsServer, uint16_t port)
 
 
 void Game::run() {
-    sf::Clock tickClock;
+    //Telling about ticks that took too long, they are what makes movement stutter.
+    ticks.onOverrun([](const SimpleNet::TickOverrun& o)
+    {
+        std::cerr << "Tick " << o.simulationTick << " took " << o.workMs << " ms (budget " << o.budgetMs << " ms)\n";
+    });
 
     while (window.isOpen() && isRunning) {
-        processEvents();
-        update();
-        handleNetwork();
-        render();
-
-        //Limit network tick
-        sf::sleep(sf::milliseconds(NETWORK_TICK_MS));
+        //Input and simulation at TICK_RATE, the network and drawing after each of them.
+        ticks.step([&](double) { processEvents(); update(); },
+                   [&]() { handleNetwork(); },
+                   [&](double) { render(); });
     }
 
+    const SimpleNet::TickStats& stats = ticks.stats();
+    std::cout << stats.simulationTicks << " ticks, " << stats.overruns << " overran, " << stats.droppedTicks << " dropped\n";
+
     SimpleNet::Net::Deinitialize();
 }
 
@@ -99,11 +104,8 @@ void Game::processEvents()
 
         localPlayer.shape.setPosition(sf::Vector2f(localPlayer.x, localPlayer.y));
 
-        //Sending the position to the server.
-        SimpleNet::Packet packet;
-        packet.appendPOD(localPlayer.x);
-        packet.appendPOD(localPlayer.y);
-        client->send(packet);
+        //Queuing the position for the server, sent by flushState. Entity 0 is always "me".
+        stateOut.set(0, PlayerPosition, NetPosition{ localPlayer.x, localPlayer.y });
     }
 
 }
@@ -129,11 +131,15 @@ void Game::render()
 
 void Game::handleNetwork() 
 {
+    //A quarter of a tick at most for incoming traffic, anything left over waits for the next tick.
+    SimpleNet::ServiceOptions serviceLimits;
+    serviceLimits.budgetUs = 1000000 / TICK_RATE / 4;
+
     //For server
    if (isServer) 
    {
        //Going through packets
-        server->service(0, [&](const SimpleNet::NetEvent& e) 
+        server->service(serviceLimits, [&](const SimpleNet::NetEvent& e) 
         {
             //Going through each packet types
             switch (e.type) 
@@ -150,6 +156,8 @@ void Game::handleNetwork()
                 //Assigning a random color to each remote player
                 remotePlayers[e.peerId].shape.setFillColor(sf::Color(rand() % 256, rand() % 256, rand() % 256));
 
+                //Sending everyone's position again so the new client sees players who are standing still.
+                stateOut.resendAll();
                 break;
             }
             //Announcing a client's departure from the realm
@@ -157,27 +165,39 @@ void Game::handleNetwork()
             {
                 std::cout << "Client " << e.peerId << " disconnected\n";
                 remotePlayers.erase(e.peerId);
+                stateIn.forgetSource(e.peerId);
+                stateOut.removeEntity(e.peerId);
                 break;
             }
             case SimpleNet::NetEvent::Receive: 
             {
-                float x, y;
-                SimpleNet::Packet p = e.packet;
-                p.readPOD(x);
-                p.readPOD(y);
-
-                //Updating the other client's position
-                if (remotePlayers.count(e.peerId)) 
+                if (e.channel != static_cast<uint8_t>(GameChannel::Movement))
                 {
-                    remotePlayers[e.peerId].updatePosition(x, y);
+                    break;
                 }
 
-                //Broadcasting update to all clients
-                SimpleNet::Packet broadcastPacket;
-                broadcastPacket.appendPOD(e.peerId); // send who moved
-                broadcastPacket.appendPOD(x);
-                broadcastPacket.appendPOD(y);
-                server->broadcast(broadcastPacket);
+                //Older positions that arrive late are dropped by stateIn.
+                stateIn.apply(e.peerId, e.packet, [&](uint32_t, uint16_t property, SimpleNet::PacketReader& value)
+                {
+                    NetPosition pos;
+                    if (property != PlayerPosition || !value.readPOD(pos))
+                    {
+                        return;
+                    }
+
+                    //Updating the other client's position
+                    if (remotePlayers.count(e.peerId)) 
+                    {
+                        remotePlayers[e.peerId].updatePosition(pos.x, pos.y);
+                    }
+
+                    //Queuing the update for all clients, keyed by who moved
+                    stateOut.set(e.peerId, PlayerPosition, pos);
+                });
+                break;
+            }
+            default:
+            {
                 break;
             }
             }
@@ -187,7 +207,7 @@ void Game::handleNetwork()
     else 
    {
        //Packets~!
-        client->service(0, [&](const SimpleNet::NetEvent& e) 
+        client->service(serviceLimits, [&](const SimpleNet::NetEvent& e) 
         {
             switch (e.type) 
             {
@@ -196,6 +216,12 @@ void Game::handleNetwork()
                 std::cout << "Connected to server.\n";
                 break;
             }
+            case SimpleNet::NetEvent::ConnectFailed:
+            {
+                std::cerr << "Failed to connect to server\n";
+                isRunning = false;
+                break;
+            }
             case SimpleNet::NetEvent::Disconnect:
             {
                 std::cout << "Disconnected from server.\n";
@@ -204,28 +230,69 @@ void Game::handleNetwork()
             }
             case SimpleNet::NetEvent::Receive: 
             {
-                uint32_t peerId;
-                float x, y;
-                SimpleNet::Packet p = e.packet;
-                p.readPOD(peerId);
-                p.readPOD(x);
-                p.readPOD(y);
-
-                //Adding new remote player if needed
-                if (!remotePlayers.count(peerId)) {
-                    remotePlayers[peerId] = Player(x, y);
-
-                    //Assigning a random color for new player
-                    remotePlayers[peerId].shape.setFillColor(
-                        sf::Color(rand() % 256, rand() % 256, rand() % 256)
-                    );
-                }
-                else {
-                    remotePlayers[peerId].updatePosition(x, y);
+                if (e.channel != static_cast<uint8_t>(GameChannel::Movement))
+                {
+                    break;
                 }
+
+                stateIn.apply(0, e.packet, [&](uint32_t peerId, uint16_t property, SimpleNet::PacketReader& value)
+                {
+                    NetPosition pos;
+                    if (property != PlayerPosition || !value.readPOD(pos))
+                    {
+                        return;
+                    }
+
+                    //Adding new remote player if needed
+                    if (!remotePlayers.count(peerId)) {
+                        remotePlayers[peerId] = Player(pos.x, pos.y);
+
+                        //Assigning a random color for new player
+                        remotePlayers[peerId].shape.setFillColor(
+                            sf::Color(rand() % 256, rand() % 256, rand() % 256)
+                        );
+                    }
+                    else {
+                        remotePlayers[peerId].updatePosition(pos.x, pos.y);
+                    }
+                });
+                break;
+            }
+            default:
+            {
                 break;
             }
             }
         });
     }
+
+    flushState();
+}
+
+//Sends whatever positions changed this tick, one packet on the unreliable Movement channel.
+void Game::flushState()
+{
+    //Holding on to the client's state until there is someone to send it to.
+    if (!isServer && !client->isConnected())
+    {
+        return;
+    }
+
+    //Only what fits in this tick's budget goes out, the rest waits with a higher priority.
+    uint32_t budget = isServer ? server->broadcastBudget(ticks.networkPeriodMs()) : client->sendBudget(ticks.networkPeriodMs());
+
+    SimpleNet::Packet packet;
+    if (!stateOut.flush(packet, std::min<size_t>(budget, 1200)))
+    {
+        return;
+    }
+
+    if (isServer)
+    {
+        server->broadcast(packet, GameChannel::Movement);
+    }
+    else
+    {
+        client->send(packet, GameChannel::Movement);
+    }
 }
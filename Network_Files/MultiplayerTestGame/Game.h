@@ -1,5 +1,6 @@
 ﻿#pragma once
 #include "SimpleNet.h"
+#include "GameProtocol.h"
 
 #include "SFML/include/SFML/System.hpp"
 #include "SFML/include/SFML/Window.hpp"
@@ -39,7 +40,7 @@ struct Player
 class Game 
 {
 public:
-    Game(bool runAsServer, uint16_t port);
+    Game(bool runAsServer, uint16_t port, const std::string& host = "localhost");
     void run();
 
 private:
@@ -48,10 +49,14 @@ private:
     void render();
 
     void handleNetwork();
+    void flushState();
 
     sf::RenderWindow window;
     sf::Clock clock;
 
+    //Runs input/simulation, networking and rendering at fixed rates.
+    SimpleNet::TickScheduler ticks;
+
     Player localPlayer;
 
     //Map of players in the same servre as local player.
@@ -65,6 +70,10 @@ private:
     std::unique_ptr<SimpleNet::NetServer> server;
     std::unique_ptr<SimpleNet::NetClient> client;
 
+    //Positions go through these instead of plain packets, only the newest one is ever sent or applied.
+    SimpleNet::StateSender stateOut;
+    SimpleNet::StateReceiver stateIn;
+
     //Serverner port numbers.
     uint16_t serverPort; 
 };
\ No newline at end of file
@@ -0,0 +1,48 @@
+#pragma once
+#include "SimpleNet.h"
+
+//What the game sends over the wire. Shared by the game and DedicatedServer so they stay compatible, no SFML in here.
+
+static constexpr uint32_t TICK_RATE = 60; //Simulation and network ticks per second, kept exact by SimpleNet::TickScheduler
+
+//The play area, new players are placed somewhere inside it.
+static constexpr uint32_t WORLD_WIDTH = 800;
+static constexpr uint32_t WORLD_HEIGHT = 600;
+
+//Channels the game talks on. Server and client use the same layout.
+enum class GameChannel : uint8_t
+{
+    Control,  //Reliable, for anything that must arrive
+    Movement  //Positions, sent every frame so a lost one just gets replaced
+};
+
+//Player properties synced through the state channel.
+enum PlayerProperty : uint16_t
+{
+    PlayerPosition
+};
+
+struct NetPosition
+{
+    float x, y;
+};
+
+//Movement gets its own unreliable channel so it never waits behind reliable traffic.
+inline SimpleNet::ChannelLayout gameChannels()
+{
+    SimpleNet::ChannelLayout layout;
+    layout.set(GameChannel::Control, SimpleNet::DeliveryMode::ReliableOrdered)
+          .set(GameChannel::Movement, SimpleNet::DeliveryMode::UnreliableSequenced);
+    return layout;
+}
+
+//What the server accepts from one client. A player sends at most one movement update a tick, this leaves
+//room for twice that. Anything beyond is dropped before the server spends time on it.
+inline SimpleNet::InboundLimits clientInboundLimits()
+{
+    SimpleNet::InboundLimits limits;
+    limits.messagesPerSec = TICK_RATE * 2;
+    limits.bytesPerSec = 16 * 1024;
+    limits.policy = SimpleNet::RateLimitPolicy::Drop;
+    return limits;
+}
@@ -5,12 +5,53 @@ extern "C"
 }
 #include <vector>
 #include <string>
+#include <string_view>
 #include <functional>
 #include <cstdint>
 #include <memory>
 #include <unordered_map>
 #include <cstring>
 #include <iostream>
+#include <atomic>
+#include <mutex>
+#include <cstdlib>
+#include <thread>
+#include <condition_variable>
+#include <deque>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <iterator>
+#include <new>
+#include <type_traits>
+#include <random>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define SIMPLENET_X86 1
+#include <nmmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+#if defined(__linux__) && defined(SIMPLENET_ENET_BATCHING)
+extern "C"
+{
+#include <enet/batched.h>
+}
+#define SIMPLENET_HOST_BATCHING 1
+#endif
+
+#ifdef __linux__
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <sched.h>
+#define SIMPLENET_MMSG 1
+#endif
 
 namespace SimpleNet 
 {
@@ -99,306 +140,6348 @@ namespace SimpleNet
         }
     };
 
-    struct NetEvent 
+    //Non-owning view over a run of bytes, only valid as long as the bytes it points into.
+    struct ByteSpan
     {
-        enum Type { Connect, Disconnect, Receive } type;
-        uint32_t peerId;  //For client role
-        Packet packet;    //Only for Receive
-    };
+        const uint8_t* data = nullptr;
+        size_t size = 0;
 
-    class NetServer;
-    class NetClient;
+        ByteSpan() = default;
+        ByteSpan(const uint8_t* d, size_t n) : data(d), size(n) {}
 
-    class Net 
+        const uint8_t* begin() const { return data; }
+        const uint8_t* end() const { return data + size; }
+        bool empty() const { return size == 0; }
+    };
+
+    //Read-only cursor over a Packet or raw buffer.
+    //Lets receive handlers read a const NetEvent& without copying the packet. The span/view reads
+    //point straight into the underlying buffer and never allocate.
+    class PacketReader
     {
     public:
-        static bool Initialize() 
+        PacketReader(const uint8_t* d, size_t n) : data(d), size(n), cursor(0) {}
+        PacketReader(ByteSpan span) : data(span.data), size(span.size), cursor(0) {}
+        explicit PacketReader(const Packet& p) : data(p.data.data()), size(p.data.size()), cursor(0) {}
+        //Would point into a temporary that is gone by the next line.
+        PacketReader(const Packet&&) = delete;
+
+        bool readBytes(void* dst, size_t len)
         {
-            if (enet_initialize() != 0) 
+            if (len > remaining())
             {
-                std::cerr << "ENet initialization failed\n";
                 return false;
             }
+
+            std::memcpy(dst, data + cursor, len);
+            cursor += len;
+
             return true;
         }
-        static void Deinitialize() 
+
+        template<typename T>
+        bool readPOD(T& out)
         {
-            enet_deinitialize();
+            return readBytes(&out, sizeof(T));
         }
-    };
 
-    class NetServer 
-    {
-    public:
-        using EventCallback = std::function<void(const NetEvent&)>;
+        bool readString(std::string& out)
+        {
+            std::string_view view;
+            if (!readStringView(view))
+            {
+                return false;
+            }
 
-        NetServer() : host(nullptr), nextPeerId(1) {}
-        ~NetServer() 
+            out.assign(view.data(), view.size());
+            return true;
+        }
+
+        //Next len bytes as a view into the buffer.
+        bool readSpan(size_t len, ByteSpan& out)
         {
-            if (host) 
+            if (len > remaining())
             {
-                enet_host_destroy(host);
-                host = nullptr;
+                return false;
             }
+
+            out = ByteSpan(data + cursor, len);
+            cursor += len;
+
+            return true;
         }
 
-        bool create(uint16_t port, uint32_t maxClients = 32) 
+        //String written by Packet::appendString (uint32 length + bytes), as a view into the buffer.
+        bool readStringView(std::string_view& out)
         {
-            ENetAddress address;
-            address.host = ENET_HOST_ANY;
-            address.port = port;
-            host = enet_host_create(&address, maxClients, 2, 0, 0);
+            size_t start = cursor;
+            uint32_t len = 0;
+            ByteSpan bytes;
 
-            if (!host) 
+            if (!readPOD(len) || !readSpan(len, bytes))
             {
-                std::cerr << "Failed to create ENet server host on port " << port << "\n";
+                cursor = start;
                 return false;
             }
+
+            out = std::string_view(reinterpret_cast<const char*>(bytes.data), bytes.size);
             return true;
         }
 
-        void service(uint32_t timeoutMs, const EventCallback& cb) 
+        bool skip(size_t len)
         {
-            if (!host)
+            if (len > remaining())
             {
-                return;
+                return false;
             }
 
-            ENetEvent event;
-            while (enet_host_service(host, &event, timeoutMs) > 0) 
-            {
-                switch (event.type) 
-                {
-                case ENET_EVENT_TYPE_CONNECT: 
-                {
-                    uint32_t id = nextPeerId++;
-                    peerMap[event.peer] = id;
-                    idMap[id] = event.peer;
-                    event.peer->data = reinterpret_cast<void*>(static_cast<uintptr_t>(id));
-                    NetEvent e;
-                    e.type = NetEvent::Connect;
-                    e.peerId = id;
-                    cb(e);
-                    break;
-                }
-                case ENET_EVENT_TYPE_DISCONNECT: 
-                {
-                    auto it = peerMap.find(event.peer);
-                    uint32_t id = 0;
+            cursor += len;
+            return true;
+        }
 
-                    if (it != peerMap.end()) 
-                    {
-                        id = it->second;
-                        peerMap.erase(it);
-                        idMap.erase(id);
-                    }
+        size_t position() const { return cursor; }
+        size_t remaining() const { return size - cursor; }
+        bool atEnd() const { return cursor == size; }
 
-                    NetEvent e;
-                    e.type = NetEvent::Disconnect;
-                    e.peerId = id;
-                    cb(e);
-                    break;
-                }
-                case ENET_EVENT_TYPE_RECEIVE: {
-                    auto it = peerMap.find(event.peer);
-                    uint32_t id = (it != peerMap.end()) ? it->second : 0;
-                    NetEvent e;
-                    e.type = NetEvent::Receive;
-                    e.peerId = id;
-                    e.packet.data.resize(event.packet->dataLength);
-                    std::memcpy(e.packet.data.data(), event.packet->data, event.packet->dataLength);
-                    cb(e);
-                    enet_packet_destroy(event.packet);
-                    break;
-                }
-                default: break;
-                }
-            }
+        //Everything not read yet.
+        ByteSpan rest() const { return ByteSpan(data + cursor, size - cursor); }
+
+    private:
+        const uint8_t* data;
+        size_t size;
+        size_t cursor;
+    };
+
+    //Why a NetClient::connectAsync attempt did not go through.
+    enum class ConnectError
+    {
+        None,
+        Timeout,   //No answer before the attempt's timeout
+        Refused,   //Server dropped or rejected the handshake
+        Unresolved,//Hostname lookup failed
+        Cancelled, //Another attempt connected first, or cancelConnect was called
+        NoSlot     //The handshake could not be started here, the server never saw it
+    };
+
+    //What happened to a send.
+    enum class SendResult
+    {
+        Ok,
+        WouldBlock, //Peer's outgoing queue is over the high-water mark, nothing was queued. Wait for Writable.
+        NoPeer,     //Unknown peer id, or not connected
+        Failed      //Bad channel, packet too big, or out of memory
+    };
+
+    struct NetEvent 
+    {
+        enum Type { Connect, Disconnect, Receive, ConnectFailed, Writable } type;
+        uint32_t peerId;  //For client role: attempt id on Connect/ConnectFailed
+        Packet packet;    //Only for Receive
+        ConnectError error = ConnectError::None; //Only for ConnectFailed
+        uint8_t channel = 0; //Only for Receive
+    };
+
+    //How a channel delivers its packets.
+    enum class DeliveryMode : uint8_t
+    {
+        ReliableOrdered,       //Resent until acked, delivered in order
+        UnreliableSequenced,   //Never resent, late packets are dropped so nothing goes backwards
+        UnreliableUnsequenced, //Never resent, delivered as soon as it arrives in any order
+        UnreliableFragment     //Like UnreliableSequenced, but packets over the MTU go as unreliable fragments
+    };
+
+    //Channel table for a host. Channels are numbered in the order they are added, or set by enum value:
+    //
+    //    enum class Channel : uint8_t { Control, Movement, Chat };
+    //    ChannelLayout layout;
+    //    layout.set(Channel::Control, DeliveryMode::ReliableOrdered)
+    //          .set(Channel::Movement, DeliveryMode::UnreliableSequenced)
+    //          .set(Channel::Chat, DeliveryMode::ReliableOrdered);
+    //
+    //Each channel is ordered on its own, so a stalled reliable chat message never holds up movement.
+    class ChannelLayout
+    {
+    public:
+        static constexpr size_t MaxChannels = ENET_PROTOCOL_MAXIMUM_CHANNEL_COUNT;
+
+        //What add() returns when the table is full. Never a real channel, valid() rejects it.
+        static constexpr uint8_t InvalidChannel = 0xFF;
+        static_assert(MaxChannels <= InvalidChannel, "InvalidChannel must be past the last channel");
+
+        //Same as the old fixed setup: 0 reliable, 1 unreliable.
+        static ChannelLayout Default()
+        {
+            ChannelLayout layout;
+            layout.add(DeliveryMode::ReliableOrdered);
+            layout.add(DeliveryMode::UnreliableSequenced);
+            return layout;
         }
 
-        bool sendTo(uint32_t peerId, const Packet& p, PacketReliability r = PacketReliability::Reliable, int channel = 0) 
+        //Returns the new channel's number, or InvalidChannel if all MaxChannels are taken.
+        uint8_t add(DeliveryMode mode)
         {
-            auto it = idMap.find(peerId);
-            if (it == idMap.end())
+            if (modes.size() >= MaxChannels)
             {
-                return false;
+                std::cerr << "ChannelLayout is full, " << MaxChannels << " channels max\n";
+                return InvalidChannel;
             }
 
-            ENetPeer* peer = it->second;
-            enet_uint32 flags = (r == PacketReliability::Reliable) ? ENET_PACKET_FLAG_RELIABLE : 0;
-            ENetPacket* packet = enet_packet_create(p.data.data(), p.data.size(), flags);
+            modes.push_back(mode);
+            return static_cast<uint8_t>(modes.size() - 1);
+        }
 
-            if (!packet)
+        //Sets the mode of the channel numbered by an enum value. Channels skipped over are ReliableOrdered.
+        template<typename Channel>
+        ChannelLayout& set(Channel channel, DeliveryMode mode)
+        {
+            static_assert(std::is_enum<Channel>::value, "Channels are addressed by enum");
+
+            size_t index = static_cast<size_t>(channel);
+            if (index >= MaxChannels)
             {
-                return false;
+                std::cerr << "Channel " << index << " is past the " << MaxChannels << " channel limit\n";
+                return *this;
             }
 
-            enet_peer_send(peer, channel, packet);
-            enet_host_flush(host);
-
-            return true;
+            if (index >= modes.size())
+            {
+                modes.resize(index + 1, DeliveryMode::ReliableOrdered);
+            }
+            modes[index] = mode;
+            return *this;
         }
 
-        void broadcast(const Packet& p, PacketReliability r = PacketReliability::Reliable, int channel = 0) 
+        size_t count() const { return modes.empty() ? 1 : modes.size(); }
+        bool valid(int channel) const { return channel >= 0 && static_cast<size_t>(channel) < count(); }
+        DeliveryMode mode(uint8_t channel) const { return channel < modes.size() ? modes[channel] : DeliveryMode::ReliableOrdered; }
+
+        //ENet packet flags for a send on this channel.
+        enet_uint32 flags(uint8_t channel) const
         {
-            if (!host)
+            switch (mode(channel))
             {
-                return;
+            case DeliveryMode::ReliableOrdered: return ENET_PACKET_FLAG_RELIABLE;
+            case DeliveryMode::UnreliableUnsequenced: return ENET_PACKET_FLAG_UNSEQUENCED;
+            case DeliveryMode::UnreliableFragment: return ENET_PACKET_FLAG_UNRELIABLE_FRAGMENT;
+            default: return 0;
             }
-
-            enet_uint32 flags = (r == PacketReliability::Reliable) ? ENET_PACKET_FLAG_RELIABLE : 0;
-            ENetPacket* packet = enet_packet_create(p.data.data(), p.data.size(), flags);
-
-            enet_host_broadcast(host, channel, packet);
-            enet_host_flush(host);
         }
 
-        void disconnect(uint32_t peerId, uint32_t data = 0) 
+        //Flags for the older sendTo(..., PacketReliability, channel) calls. Reliable always wins, unreliable
+        //sends follow the channel's unreliable mode, and on a reliable channel fall back to sequenced.
+        enet_uint32 flags(uint8_t channel, PacketReliability r) const
         {
-            auto it = idMap.find(peerId);
-            if (it == idMap.end())
+            if (r == PacketReliability::Reliable)
             {
-                return;
+                return ENET_PACKET_FLAG_RELIABLE;
             }
-
-            enet_peer_disconnect(it->second, data);
+            return mode(channel) == DeliveryMode::ReliableOrdered ? 0 : flags(channel);
         }
 
-        size_t connectedCount() const { return peerMap.size(); }
-
     private:
+        std::vector<DeliveryMode> modes;
+    };
 
-        ENetHost* host;
-        uint32_t nextPeerId;
-
-        std::unordered_map<ENetPeer*, uint32_t> peerMap;
-        std::unordered_map<uint32_t, ENetPeer*> idMap;
+    struct ChannelStats
+    {
+        uint64_t packetsSent = 0;
+        uint64_t bytesSent = 0;
+        uint64_t packetsReceived = 0;
+        uint64_t bytesReceived = 0;
     };
 
-    class NetClient 
+    //Per-channel send/receive counters kept by NetServer and NetClient.
+    class ChannelCounters
     {
     public:
-        using EventCallback = std::function<void(const NetEvent&)>;
+        void reset(size_t channelCount) { stats.assign(channelCount, ChannelStats()); }
 
-        NetClient() : clientHost(nullptr), serverPeer(nullptr) {}
-        ~NetClient() 
+        void sent(uint8_t channel, size_t bytes, size_t packets = 1)
         {
-            if (clientHost) 
+            if (channel < stats.size())
             {
-                enet_host_destroy(clientHost);
-                clientHost = nullptr;
+                stats[channel].packetsSent += packets;
+                stats[channel].bytesSent += bytes * packets;
             }
         }
 
-        bool connect(const std::string& host, uint16_t port, uint32_t timeoutMs = 5000) 
+        void received(uint8_t channel, size_t bytes)
         {
-            clientHost = enet_host_create(NULL, 1, 2, 0, 0);
-            if (!clientHost) 
+            if (channel < stats.size())
             {
-                std::cerr << "Failed to create ENet client host\n";
-                return false;
+                ++stats[channel].packetsReceived;
+                stats[channel].bytesReceived += bytes;
             }
+        }
 
-            ENetAddress address;
-            enet_address_set_host(&address, host.c_str());
-            address.port = port;
+        ChannelStats get(uint8_t channel) const { return channel < stats.size() ? stats[channel] : ChannelStats(); }
 
-            serverPeer = enet_host_connect(clientHost, &address, 2, 0);
-            if (!serverPeer) 
+    private:
+        std::vector<ChannelStats> stats;
+    };
+
+    //Link quality ENet measures for a connection.
+    struct PeerStats
+    {
+        uint32_t rttMs = 0;          //Smoothed round trip time
+        uint32_t rttVarianceMs = 0;
+        uint32_t lowestRttMs = 0;
+        float packetLoss = 0.0f;     //Smoothed fraction of reliable packets lost, 0-1
+        uint32_t throttle = 0;       //ENet's send throttle, ENET_PEER_PACKET_THROTTLE_SCALE is unthrottled
+
+        static PeerStats of(const ENetPeer* peer)
+        {
+            PeerStats s;
+            s.rttMs = peer->roundTripTime;
+            s.rttVarianceMs = peer->roundTripTimeVariance;
+            s.lowestRttMs = peer->lowestRoundTripTime;
+            s.packetLoss = static_cast<float>(peer->packetLoss) / ENET_PEER_PACKET_LOSS_SCALE;
+            s.throttle = peer->packetThrottle;
+            return s;
+        }
+    };
+
+    //Lets sendTo/send take a channel enum without also catching PacketReliability.
+    template<typename T>
+    using EnableIfChannel = std::enable_if_t<std::is_enum<T>::value && !std::is_same<T, PacketReliability>::value, int>;
+
+    //Picks which pending updates go out when they do not all fit in a send budget.
+    //Every drain() adds each pending item's importance to its priority, so items that keep missing out
+    //get more urgent the longer they wait. The highest priorities that fit go first, the rest carry over.
+    class PriorityAccumulator
+    {
+    public:
+        //Marks key as having an update of size bytes. An already pending key keeps its priority.
+        void set(uint64_t key, float importance, size_t size)
+        {
+            auto found = index.find(key);
+            if (found != index.end())
             {
-                std::cerr << "No available peers for initiating connection\n";
-                return false;
+                items[found->second].importance = importance;
+                items[found->second].size = size;
+                return;
             }
 
-            ENetEvent event;
-            if (enet_host_service(clientHost, &event, timeoutMs) > 0 && event.type == ENET_EVENT_TYPE_CONNECT) 
+            index.emplace(key, items.size());
+            items.push_back(Item{ key, importance, 0.0f, size });
+        }
+
+        void remove(uint64_t key)
+        {
+            auto found = index.find(key);
+            if (found == index.end())
             {
-                return true;
+                return;
             }
 
-            enet_peer_reset(serverPeer);
-            serverPeer = nullptr;
-            return false;
+            size_t slot = found->second;
+            index.erase(found);
+            if (slot != items.size() - 1)
+            {
+                items[slot] = items.back();
+                index[items[slot].key] = slot;
+            }
+            items.pop_back();
         }
 
-        void service(uint32_t timeoutMs, const EventCallback& cb) 
+        bool contains(uint64_t key) const { return index.count(key) != 0; }
+        size_t pendingCount() const { return items.size(); }
+        bool empty() const { return items.empty(); }
+
+        //Calls send(key) for the highest-priority items whose sizes fit in budget, best first.
+        //send returns false to skip an item (it stays pending). Sent items are no longer pending.
+        //Returns the bytes spent.
+        template<typename Fn>
+        size_t drain(size_t budget, Fn&& send)
         {
-            if (!clientHost)
+            for (Item& item : items)
             {
-                return;
+                item.priority += item.importance;
             }
 
-            ENetEvent event;
-            while (enet_host_service(clientHost, &event, timeoutMs) > 0) 
+            order.resize(items.size());
+            for (size_t i = 0; i < order.size(); ++i)
             {
-                switch (event.type)
-                {
-                case ENET_EVENT_TYPE_CONNECT:
-                {
-                    NetEvent e;
-                    e.type = NetEvent::Connect;
-                    e.peerId = 0;
-                    cb(e);
+                order[i] = i;
+            }
+            std::sort(order.begin(), order.end(), [this](size_t a, size_t b) { return items[a].priority > items[b].priority; });
 
-                    break;
-                }
-                case ENET_EVENT_TYPE_DISCONNECT:
+            size_t spent = 0;
+            sent.clear();
+            for (size_t slot : order)
+            {
+                const Item& item = items[slot];
+                if (item.size > budget - spent)
                 {
-                    NetEvent e;
-                    e.type = NetEvent::Disconnect;
-                    e.peerId = 0;
-                    cb(e);
-
-                    break;
+                    continue;
                 }
-                case ENET_EVENT_TYPE_RECEIVE:
-                {
-                    NetEvent e;
-                    e.type = NetEvent::Receive;
-                    e.peerId = 0;
-                    e.packet.data.resize(event.packet->dataLength);
-
-                    std::memcpy(e.packet.data.data(), event.packet->data, event.packet->dataLength);
-                    cb(e);
-                    enet_packet_destroy(event.packet);
 
-                    break;
+                if (send(item.key))
+                {
+                    spent += item.size;
+                    sent.push_back(item.key);
                 }
-                default:
+
+                if (spent == budget)
                 {
                     break;
                 }
-                }
             }
+
+            for (uint64_t key : sent)
+            {
+                remove(key);
+            }
+            return spent;
         }
 
-        bool send(const Packet& p, PacketReliability r = PacketReliability::Reliable, int channel = 0) 
+    private:
+        struct Item
         {
-            if (!serverPeer)
+            uint64_t key;
+            float importance;
+            float priority;
+            size_t size;
+        };
+
+        std::vector<Item> items;
+        std::unordered_map<uint64_t, size_t> index;
+        std::vector<size_t> order;
+        std::vector<uint64_t> sent;
+    };
+
+    //Latest-value-wins state, keyed by (entity, property). Meant for things like positions that are
+    //resent constantly: send the packets on an unreliable channel and a lost update is simply replaced
+    //by the next one instead of being retransmitted and holding newer values up.
+    //
+    //Wire format: [u16 count] then count x [u32 entity][u16 property][u16 sequence][u8 size][size bytes].
+    //
+    //Sender side. set() overwrites whatever is still queued for the key, flush() writes changed keys
+    //once. Each change is also repeated in the next `redundancy` flushes so a single lost packet does not
+    //lose it, since nothing gets resent otherwise. When not everything fits in a flush, keys are picked
+    //by a PriorityAccumulator using the importance given to set().
+    class StateSender
+    {
+    public:
+        static constexpr size_t MaxValueSize = 255;
+
+        explicit StateSender(uint8_t redundancy = 2) : redundancy(redundancy) {}
+
+        //Values that are the same as the last one written for the key are skipped.
+        template<typename T>
+        bool set(uint32_t entity, uint16_t property, const T& value, float importance = 1.0f)
+        {
+            static_assert(std::is_trivially_copyable<T>::value, "State values must be POD");
+            return setBytes(entity, property, &value, sizeof(T), importance);
+        }
+
+        bool setBytes(uint32_t entity, uint16_t property, const void* value, size_t size, float importance = 1.0f)
+        {
+            if (size > MaxValueSize)
             {
+                std::cerr << "State value for entity " << entity << " is " << size << " bytes, max is " << MaxValueSize << "\n";
                 return false;
             }
 
-            enet_uint32 flags = (r == PacketReliability::Reliable) ? ENET_PACKET_FLAG_RELIABLE : 0;
-            ENetPacket* packet = enet_packet_create(p.data.data(), p.data.size(), flags);
-
-            enet_peer_send(serverPeer, channel, packet);
-            enet_host_flush(clientHost);
+            auto found = index.find(keyOf(entity, property));
+            if (found == index.end())
+            {
+                found = index.emplace(keyOf(entity, property), entries.size()).first;
+                entries.emplace_back();
+                entries.back().entity = entity;
+                entries.back().property = property;
+            }
+            else
+            {
+                Entry& existing = entries[found->second];
+                if (existing.value.size() == size && std::memcmp(existing.value.data(), value, size) == 0)
+                {
+                    return true;
+                }
+            }
 
+            //Whatever was queued for this key is superseded, only the newest value goes out.
+            Entry& e = entries[found->second];
+            const uint8_t* b = static_cast<const uint8_t*>(value);
+            e.value.assign(b, b + size);
+            e.importance = importance;
+            ++e.sequence;
+            e.sendsLeft = static_cast<uint8_t>(redundancy + 1);
+            queue(e);
             return true;
         }
 
-        void disconnect(uint32_t data = 0) 
+        void remove(uint32_t entity, uint16_t property)
         {
-            if (serverPeer)
+            auto found = index.find(keyOf(entity, property));
+            if (found == index.end())
             {
-                enet_peer_disconnect(serverPeer, data);
+                return;
+            }
+
+            //Swap with the last entry to keep the vector packed.
+            size_t slot = found->second;
+            index.erase(found);
+            accumulator.remove(keyOf(entity, property));
+            if (slot != entries.size() - 1)
+            {
+                entries[slot] = std::move(entries.back());
+                index[keyOf(entries[slot].entity, entries[slot].property)] = slot;
             }
+            entries.pop_back();
         }
 
-    private:
+        //Drops every property of an entity, e.g. when a player leaves.
+        void removeEntity(uint32_t entity)
+        {
+            for (size_t i = entries.size(); i-- > 0;)
+            {
+                if (entries[i].entity == entity)
+                {
+                    remove(entity, entries[i].property);
+                }
+            }
+        }
+
+        //Queues every key again, e.g. so a newly connected peer gets the full state.
+        void resendAll()
+        {
+            for (Entry& e : entries)
+            {
+                e.sendsLeft = static_cast<uint8_t>(redundancy + 1);
+                queue(e);
+            }
+        }
+
+        bool pending() const { return !accumulator.empty(); }
+
+        //Writes queued values into out, up to maxBytes (e.g. a peer's NetServer::sendBudget).
+        //Keys that do not fit stay queued and gain priority for the next flush.
+        //Returns false if there was nothing to send.
+        bool flush(Packet& out, size_t maxBytes = 1200)
+        {
+            out.data.clear();
+            out.appendPOD(static_cast<uint16_t>(0));
+            if (maxBytes <= out.data.size())
+            {
+                return false;
+            }
+
+            uint16_t count = 0;
+            repeats.clear();
+            accumulator.drain(maxBytes - out.data.size(), [&](uint64_t key)
+            {
+                if (count == UINT16_MAX)
+                {
+                    return false;
+                }
+
+                Entry& e = entries[index[key]];
+                out.appendPOD(e.entity);
+                out.appendPOD(e.property);
+                out.appendPOD(e.sequence);
+                out.appendPOD(static_cast<uint8_t>(e.value.size()));
+                out.appendBytes(e.value.data(), e.value.size());
+
+                ++count;
+                if (--e.sendsLeft)
+                {
+                    repeats.push_back(key);
+                }
+                return true;
+            });
+
+            //Redundant copies go back in the queue, starting from zero priority.
+            for (uint64_t key : repeats)
+            {
+                queue(entries[index[key]]);
+            }
+
+            std::memcpy(out.data.data(), &count, sizeof(count));
+            return count > 0;
+        }
+
+    private:
+        struct Entry
+        {
+            uint32_t entity = 0;
+            uint16_t property = 0;
+            uint16_t sequence = 0;
+            uint8_t sendsLeft = 0;
+            float importance = 1.0f;
+            std::vector<uint8_t> value;
+        };
+
+        static constexpr size_t EntryHeaderSize = sizeof(uint32_t) + 2 * sizeof(uint16_t) + sizeof(uint8_t);
+
+        static uint64_t keyOf(uint32_t entity, uint16_t property) { return (static_cast<uint64_t>(entity) << 16) | property; }
+
+        void queue(const Entry& e)
+        {
+            accumulator.set(keyOf(e.entity, e.property), e.importance, EntryHeaderSize + e.value.size());
+        }
+
+        uint8_t redundancy;
+        std::vector<Entry> entries;
+        std::unordered_map<uint64_t, size_t> index;
+        PriorityAccumulator accumulator;
+        std::vector<uint64_t> repeats;
+    };
+
+    //Receiver side of StateSender. Keeps the last sequence seen per (source, entity, property) and only
+    //passes on values newer than that, so reordered or repeated updates never move state backwards.
+    //source tells senders apart, e.g. the peer id on a server and 0 on a client.
+    class StateReceiver
+    {
+    public:
+        //Fn is void(uint32_t entity, uint16_t property, PacketReader& value).
+        //Returns false if the packet was malformed. Values before the bad spot are still applied.
+        template<typename Fn>
+        bool apply(uint32_t source, const Packet& packet, Fn&& fn)
+        {
+            PacketReader r(packet);
+            uint16_t count = 0;
+            if (!r.readPOD(count))
+            {
+                return false;
+            }
+
+            for (uint16_t i = 0; i < count; ++i)
+            {
+                uint32_t entity;
+                uint16_t property, sequence;
+                uint8_t size;
+                ByteSpan value;
+                if (!r.readPOD(entity) || !r.readPOD(property) || !r.readPOD(sequence) || !r.readPOD(size) || !r.readSpan(size, value))
+                {
+                    return false;
+                }
+
+                Key key{ source, entity, property };
+                auto it = lastSequence.find(key);
+                if (it != lastSequence.end())
+                {
+                    if (!newer(sequence, it->second))
+                    {
+                        ++dropped;
+                        continue;
+                    }
+                    it->second = sequence;
+                }
+                else
+                {
+                    lastSequence.emplace(key, sequence);
+                }
+
+                PacketReader valueReader(value);
+                fn(entity, property, valueReader);
+            }
+            return true;
+        }
+
+        //Forgets everything from a source, e.g. when that peer disconnects.
+        void forgetSource(uint32_t source)
+        {
+            for (auto it = lastSequence.begin(); it != lastSequence.end();)
+            {
+                if (it->first.source == source)
+                {
+                    it = lastSequence.erase(it);
+                }
+                else
+                {
+                    ++it;
+                }
+            }
+        }
+
+        //Updates thrown away for being older than (or a copy of) what was already applied.
+        uint64_t droppedCount() const { return dropped; }
+
+    private:
+        struct Key
+        {
+            uint32_t source;
+            uint32_t entity;
+            uint16_t property;
+
+            bool operator==(const Key& o) const { return source == o.source && entity == o.entity && property == o.property; }
+        };
+
+        struct KeyHash
+        {
+            size_t operator()(const Key& k) const
+            {
+                uint64_t h = (static_cast<uint64_t>(k.source) << 32 | k.entity) * 0x9E3779B97F4A7C15ull;
+                return static_cast<size_t>(h ^ (h >> 29) ^ k.property);
+            }
+        };
+
+        //Sequence numbers wrap, a is newer if it is less than half the range ahead of b.
+        static bool newer(uint16_t a, uint16_t b) { return static_cast<int16_t>(static_cast<uint16_t>(a - b)) > 0; }
+
+        std::unordered_map<Key, uint16_t, KeyHash> lastSequence;
+        uint64_t dropped = 0;
+    };
+
+    //Large payload transfers, sent as chunks instead of one huge packet.
+    //
+    //Give streams their own ReliableOrdered channel in the ChannelLayout. Gameplay channels are ordered
+    //separately and never wait behind it, and the sender only keeps windowBytes unacknowledged and stays
+    //under rateBytesPerSec, so a transfer cannot fill ENet's queues either.
+    //
+    //Wire format, first byte is the message type:
+    //    Begin  [u32 id][u64 total][u32 chunkSize][u32 windowBytes]
+    //    Chunk  [u32 id][u64 offset][bytes]
+    //    Ack    [u32 id][u64 bytes received in a row]
+    //    Cancel [u32 id]
+    struct StreamProgress
+    {
+        uint32_t transferId = 0;
+        uint64_t bytesDone = 0;  //Acked bytes on the sender, stored bytes on the receiver
+        uint64_t bytesTotal = 0;
+        bool complete = false;
+        bool failed = false;     //Cancelled by either side, or the source/sink failed
+    };
+
+    class StreamProtocol
+    {
+    public:
+        enum Type : uint8_t
+        {
+            Begin = 1,
+            Chunk = 2,
+            Ack = 3,
+            Cancel = 4
+        };
+
+        static Packet makeCancel(uint32_t id)
+        {
+            Packet p;
+            p.appendPOD(static_cast<uint8_t>(Cancel));
+            p.appendPOD(id);
+            return p;
+        }
+
+        static Packet makeAck(uint32_t id, uint64_t received)
+        {
+            Packet p;
+            p.appendPOD(static_cast<uint8_t>(Ack));
+            p.appendPOD(id);
+            p.appendPOD(received);
+            return p;
+        }
+
+        static Packet makeBegin(uint32_t id, uint64_t total, uint32_t chunkSize, uint32_t windowBytes)
+        {
+            Packet p;
+            p.appendPOD(static_cast<uint8_t>(Begin));
+            p.appendPOD(id);
+            p.appendPOD(total);
+            p.appendPOD(chunkSize);
+            p.appendPOD(windowBytes);
+            return p;
+        }
+    };
+
+    struct StreamOptions
+    {
+        uint32_t chunkSize = 1024;             //Stays under the MTU so ENet never fragments
+        uint32_t windowBytes = 64 * 1024;      //Max sent but not acked, per transfer
+        uint32_t rateBytesPerSec = 256 * 1024; //0 for no cap
+    };
+
+    //Sending side of a stream, one per connection. Feed it what arrives on the stream channel and call
+    //pump() every tick with a function that sends on that channel, e.g.
+    //    [&](const Packet& p) { return server.sendTo(peerId, p, Channel::Stream); }
+    class StreamSender
+    {
+    public:
+        using SendFn = std::function<SendResult(const Packet&)>;
+        using ProgressFn = std::function<void(const StreamProgress&)>;
+
+        explicit StreamSender(const StreamOptions& options = StreamOptions()) : options(options), nextId(1), tokens(0), lastRefill(0) {}
+
+        void onProgress(ProgressFn fn) { progressFn = std::move(fn); }
+
+        //Sends size bytes from data, which must stay alive and unchanged until the transfer ends.
+        //Returns the transfer id, or 0 if data is null with a non-zero size.
+        uint32_t send(const void* data, size_t size)
+        {
+            if (!data && size)
+            {
+                std::cerr << "Stream send of " << size << " bytes from a null buffer\n";
+                return 0;
+            }
+
+            Transfer t;
+            t.id = nextId++;
+            t.data = static_cast<const uint8_t*>(data);
+            t.total = size;
+            transfers.push_back(std::move(t));
+            return transfers.back().id;
+        }
+
+        //Streams a file from disk, read chunk by chunk. Returns 0 if it cannot be opened.
+        uint32_t sendFile(const std::string& path)
+        {
+            auto file = std::make_shared<std::ifstream>(path, std::ios::binary | std::ios::ate);
+            if (!*file)
+            {
+                std::cerr << "Failed to open " << path << " for streaming\n";
+                return 0;
+            }
+
+            Transfer t;
+            t.id = nextId++;
+            t.total = static_cast<uint64_t>(file->tellg());
+            file->seekg(0);
+            t.file = std::move(file);
+            transfers.push_back(std::move(t));
+            return transfers.back().id;
+        }
+
+        void cancel(uint32_t transferId, const SendFn& sendFn)
+        {
+            for (size_t i = 0; i < transfers.size(); ++i)
+            {
+                if (transfers[i].id == transferId)
+                {
+                    sendFn(StreamProtocol::makeCancel(transferId));
+                    finish(i, true);
+                    return;
+                }
+            }
+        }
+
+        //Handles a packet from the stream channel. Returns false if it was not a stream message.
+        bool handle(const Packet& p)
+        {
+            PacketReader r(p);
+            uint8_t type = 0;
+            uint32_t id = 0;
+            if (!r.readPOD(type) || !r.readPOD(id))
+            {
+                return false;
+            }
+
+            for (size_t i = 0; i < transfers.size(); ++i)
+            {
+                Transfer& t = transfers[i];
+                if (t.id != id)
+                {
+                    continue;
+                }
+
+                if (type == StreamProtocol::Cancel)
+                {
+                    finish(i, true);
+                    return true;
+                }
+
+                uint64_t acked = 0;
+                if (type != StreamProtocol::Ack || !r.readPOD(acked) || acked <= t.acked || acked > t.sent)
+                {
+                    return type == StreamProtocol::Ack;
+                }
+
+                t.acked = acked;
+                if (t.acked == t.total)
+                {
+                    finish(i, false);
+                }
+                else
+                {
+                    report(t, false, false);
+                }
+                return true;
+            }
+            return type == StreamProtocol::Ack || type == StreamProtocol::Cancel;
+        }
+
+        //Sends as many chunks as the window, rate cap and send function allow. Transfers take turns.
+        void pump(const SendFn& sendFn)
+        {
+            refill();
+
+            bool progressed = true;
+            while (progressed)
+            {
+                progressed = false;
+                for (size_t i = 0; i < transfers.size(); ++i)
+                {
+                    Transfer& t = transfers[i];
+                    if (!t.begun)
+                    {
+                        SendResult result = sendFn(StreamProtocol::makeBegin(t.id, t.total, options.chunkSize, options.windowBytes));
+                        if (result == SendResult::WouldBlock)
+                        {
+                            return;
+                        }
+                        if (result != SendResult::Ok)
+                        {
+                            finish(i, true);
+                            progressed = true;
+                            break;
+                        }
+                        t.begun = true;
+
+                        if (t.total == 0)
+                        {
+                            finish(i, false);
+                            progressed = true;
+                            break;
+                        }
+                    }
+
+                    if (t.sent == t.total || t.sent - t.acked >= options.windowBytes)
+                    {
+                        continue;
+                    }
+
+                    size_t length = static_cast<size_t>(std::min<uint64_t>(options.chunkSize, t.total - t.sent));
+                    if (options.rateBytesPerSec && tokens < static_cast<int64_t>(length))
+                    {
+                        return;
+                    }
+
+                    if (!writeChunk(t, length))
+                    {
+                        sendFn(StreamProtocol::makeCancel(t.id));
+                        finish(i, true);
+                        progressed = true;
+                        break;
+                    }
+
+                    SendResult result = sendFn(chunk);
+                    if (result == SendResult::WouldBlock)
+                    {
+                        return;
+                    }
+                    if (result != SendResult::Ok)
+                    {
+                        finish(i, true);
+                        progressed = true;
+                        break;
+                    }
+
+                    t.sent += length;
+                    tokens -= static_cast<int64_t>(length);
+                    progressed = true;
+                }
+            }
+        }
+
+        size_t activeCount() const { return transfers.size(); }
+
+    private:
+        struct Transfer
+        {
+            uint32_t id = 0;
+            const uint8_t* data = nullptr;
+            std::shared_ptr<std::ifstream> file;
+            uint64_t total = 0;
+            uint64_t sent = 0;
+            uint64_t acked = 0;
+            bool begun = false;
+        };
+
+        //Fills chunk with the next length bytes of t.
+        bool writeChunk(Transfer& t, size_t length)
+        {
+            chunk.data.clear();
+            chunk.appendPOD(static_cast<uint8_t>(StreamProtocol::Chunk));
+            chunk.appendPOD(t.id);
+            chunk.appendPOD(t.sent);
+
+            if (t.data)
+            {
+                chunk.appendBytes(t.data + t.sent, length);
+                return true;
+            }
+
+            size_t header = chunk.data.size();
+            chunk.data.resize(header + length);
+            t.file->read(reinterpret_cast<char*>(chunk.data.data() + header), static_cast<std::streamsize>(length));
+            return static_cast<size_t>(t.file->gcount()) == length;
+        }
+
+        //Token bucket for the rate cap, holding at most 50ms worth (and always room for one chunk).
+        void refill()
+        {
+            if (!options.rateBytesPerSec)
+            {
+                return;
+            }
+
+            enet_uint32 now = enet_time_get();
+            if (!lastRefill)
+            {
+                lastRefill = now;
+                tokens = options.chunkSize;
+                return;
+            }
+
+            int64_t capacity = std::max<int64_t>(options.chunkSize, options.rateBytesPerSec / 20);
+            tokens = std::min<int64_t>(capacity, tokens + static_cast<int64_t>(options.rateBytesPerSec) * (now - lastRefill) / 1000);
+            lastRefill = now;
+        }
+
+        void report(const Transfer& t, bool complete, bool failed)
+        {
+            if (!progressFn)
+            {
+                return;
+            }
+
+            StreamProgress progress;
+            progress.transferId = t.id;
+            progress.bytesDone = t.acked;
+            progress.bytesTotal = t.total;
+            progress.complete = complete;
+            progress.failed = failed;
+            progressFn(progress);
+        }
+
+        void finish(size_t index, bool failed)
+        {
+            Transfer t = std::move(transfers[index]);
+            transfers.erase(transfers.begin() + index);
+            report(t, !failed, failed);
+        }
+
+        StreamOptions options;
+        uint32_t nextId;
+        int64_t tokens;
+        enet_uint32 lastRefill;
+        std::vector<Transfer> transfers;
+        Packet chunk;
+        ProgressFn progressFn;
+    };
+
+    //Receiving side of a stream, one per connection. Every incoming transfer is offered to the accept
+    //handler, which says where it should go: a buffer the caller owns, or a file. Rejecting it cancels it.
+    class StreamReceiver
+    {
+    public:
+        struct Target
+        {
+            uint8_t* buffer = nullptr;  //Must hold the whole transfer and outlive it
+            size_t capacity = 0;
+            std::string filePath;       //Used if buffer is null
+        };
+
+        using SendFn = StreamSender::SendFn;
+        using ProgressFn = StreamSender::ProgressFn;
+        using AcceptFn = std::function<bool(uint32_t transferId, uint64_t totalBytes, Target& target)>;
+
+        //Acks go out every ackEveryBytes, or every half of the sender's window if that is smaller, so the
+        //sender never sits at a full window waiting for an ack that isn't coming.
+        explicit StreamReceiver(uint32_t ackEveryBytes = 16 * 1024) : ackEvery(ackEveryBytes) {}
+
+        void onAccept(AcceptFn fn) { acceptFn = std::move(fn); }
+        void onProgress(ProgressFn fn) { progressFn = std::move(fn); }
+
+        //Handles a packet from the stream channel, sending acks and cancels through sendFn.
+        //Returns false if it was not a stream message.
+        bool handle(const Packet& p, const SendFn& sendFn)
+        {
+            PacketReader r(p);
+            uint8_t type = 0;
+            uint32_t id = 0;
+            if (!r.readPOD(type) || !r.readPOD(id))
+            {
+                return false;
+            }
+
+            switch (type)
+            {
+            case StreamProtocol::Begin:
+            {
+                uint64_t total = 0;
+                uint32_t chunkSize = 0;
+                uint32_t window = 0;
+                if (!r.readPOD(total) || !r.readPOD(chunkSize) || !r.readPOD(window))
+                {
+                    return false;
+                }
+                begin(id, total, window, sendFn);
+                return true;
+            }
+            case StreamProtocol::Chunk:
+            {
+                uint64_t offset = 0;
+                if (!r.readPOD(offset))
+                {
+                    return false;
+                }
+                chunk(id, offset, r.rest(), sendFn);
+                return true;
+            }
+            case StreamProtocol::Cancel:
+            {
+                auto it = incoming.find(id);
+                if (it != incoming.end())
+                {
+                    finish(it, true);
+                }
+                return true;
+            }
+            default:
+                return false;
+            }
+        }
+
+        size_t activeCount() const { return incoming.size(); }
+
+    private:
+        struct Incoming
+        {
+            Target target;
+            std::unique_ptr<std::ofstream> file;
+            uint64_t total = 0;
+            uint64_t received = 0;
+            uint64_t lastAck = 0;
+            uint32_t ackStep = 0;
+        };
+
+        void begin(uint32_t id, uint64_t total, uint32_t window, const SendFn& sendFn)
+        {
+            Incoming in;
+            in.total = total;
+            in.ackStep = std::max<uint32_t>(1, std::min(ackEvery, window / 2));
+
+            bool accepted = acceptFn && acceptFn(id, total, in.target);
+            if (accepted && in.target.buffer)
+            {
+                accepted = in.target.capacity >= total;
+            }
+            else if (accepted)
+            {
+                in.file.reset(new std::ofstream(in.target.filePath, std::ios::binary | std::ios::trunc));
+                accepted = in.target.filePath.size() && *in.file;
+            }
+
+            if (!accepted)
+            {
+                sendFn(StreamProtocol::makeCancel(id));
+                return;
+            }
+
+            auto it = incoming.emplace(id, std::move(in)).first;
+            if (total == 0)
+            {
+                sendFn(StreamProtocol::makeAck(id, 0));
+                finish(it, false);
+            }
+        }
+
+        void chunk(uint32_t id, uint64_t offset, ByteSpan bytes, const SendFn& sendFn)
+        {
+            auto it = incoming.find(id);
+            if (it == incoming.end())
+            {
+                return;
+            }
+
+            //The channel is reliable and ordered, so chunks come in exactly in sequence.
+            Incoming& in = it->second;
+            if (offset != in.received || bytes.size > in.total - in.received)
+            {
+                sendFn(StreamProtocol::makeCancel(id));
+                finish(it, true);
+                return;
+            }
+
+            if (in.target.buffer)
+            {
+                std::memcpy(in.target.buffer + offset, bytes.data, bytes.size);
+            }
+            else if (!in.file->write(reinterpret_cast<const char*>(bytes.data), static_cast<std::streamsize>(bytes.size)))
+            {
+                sendFn(StreamProtocol::makeCancel(id));
+                finish(it, true);
+                return;
+            }
+
+            in.received += bytes.size;
+            bool done = in.received == in.total;
+            if (done || in.received - in.lastAck >= in.ackStep)
+            {
+                sendFn(StreamProtocol::makeAck(id, in.received));
+                in.lastAck = in.received;
+            }
+
+            if (done)
+            {
+                finish(it, false);
+            }
+            else
+            {
+                report(id, in, false, false);
+            }
+        }
+
+        void report(uint32_t id, const Incoming& in, bool complete, bool failed)
+        {
+            if (!progressFn)
+            {
+                return;
+            }
+
+            StreamProgress progress;
+            progress.transferId = id;
+            progress.bytesDone = in.received;
+            progress.bytesTotal = in.total;
+            progress.complete = complete;
+            progress.failed = failed;
+            progressFn(progress);
+        }
+
+        void finish(std::unordered_map<uint32_t, Incoming>::iterator it, bool failed)
+        {
+            uint32_t id = it->first;
+            Incoming in = std::move(it->second);
+            incoming.erase(it);
+
+            if (in.file)
+            {
+                in.file->close();
+            }
+            report(id, in, !failed, failed);
+        }
+
+        uint32_t ackEvery;
+        std::unordered_map<uint32_t, Incoming> incoming;
+        AcceptFn acceptFn;
+        ProgressFn progressFn;
+    };
+
+    class NetServer;
+    class NetClient;
+    class ShardedServer;
+
+    enum class AllocatorPolicy
+    {
+        System, //ENet uses plain malloc/free
+        Pooled  //Size class pool with per-thread caches (default)
+    };
+
+    //Everything allocated through NetAllocator: ENet's memory under AllocatorPolicy::Pooled, plus the
+    //MpscQueue nodes behind ThreadSafeSender, which come from the pool under either policy.
+    struct AllocatorStats
+    {
+        uint64_t liveBytes = 0;      //Bytes currently handed out
+        uint64_t peakBytes = 0;      //Highest liveBytes seen since the last Initialize (or resetPeak)
+        uint64_t allocations = 0;    //Total allocations served
+        uint64_t systemAllocations = 0; //Allocations that had to go to malloc
+    };
+
+    //Thread-aware size class pool used as ENet's allocator.
+    //Every ENetPacket, command and acknowledgement ENet creates comes through here. Each thread keeps
+    //small free lists per size class, overflow goes to a shared depot so blocks freed on another
+    //thread (e.g. packets built on a worker, destroyed by the network thread) find their way back.
+    class NetAllocator
+    {
+    public:
+        static void* allocate(size_t size)
+        {
+            State& s = state();
+            int sizeClass = classFor(size);
+            Header* h = nullptr;
+
+            if (sizeClass < 0)
+            {
+                h = static_cast<Header*>(std::malloc(sizeof(Header) + size));
+                s.systemAllocations.fetch_add(1, std::memory_order_relaxed);
+            }
+            else
+            {
+                h = threadCacheGone() ? nullptr : threadCache().pop(sizeClass);
+                if (!h)
+                {
+                    h = static_cast<Header*>(std::malloc(sizeof(Header) + classSize(sizeClass)));
+                    s.systemAllocations.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+
+            if (!h)
+            {
+                return nullptr;
+            }
+
+            h->sizeClass = sizeClass;
+            h->size = size;
+            s.allocations.fetch_add(1, std::memory_order_relaxed);
+
+            uint64_t live = s.liveBytes.fetch_add(size, std::memory_order_relaxed) + size;
+            uint64_t peak = s.peakBytes.load(std::memory_order_relaxed);
+            while (live > peak && !s.peakBytes.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {}
+
+            return h + 1;
+        }
+
+        static void release(void* p)
+        {
+            if (!p)
+            {
+                return;
+            }
+
+            Header* h = static_cast<Header*>(p) - 1;
+            state().liveBytes.fetch_sub(h->size, std::memory_order_relaxed);
+
+            if (h->sizeClass < 0)
+            {
+                std::free(h);
+                return;
+            }
+
+            if (threadCacheGone())
+            {
+                depotPush(h);
+                return;
+            }
+
+            threadCache().push(h);
+        }
+
+        static AllocatorStats stats()
+        {
+            State& s = state();
+            AllocatorStats out;
+            out.liveBytes = s.liveBytes.load(std::memory_order_relaxed);
+            out.peakBytes = s.peakBytes.load(std::memory_order_relaxed);
+            out.allocations = s.allocations.load(std::memory_order_relaxed);
+            out.systemAllocations = s.systemAllocations.load(std::memory_order_relaxed);
+            return out;
+        }
+
+        static void resetPeak()
+        {
+            State& s = state();
+            s.peakBytes.store(s.liveBytes.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        }
+
+        //Returns the calling thread's cached blocks and the shared depot to the system.
+        //Blocks cached by other live threads stay with them.
+        static void trim()
+        {
+            if (!threadCacheGone())
+            {
+                threadCache().flushAll();
+            }
+
+            State& s = state();
+            for (int c = 0; c < ClassCount; ++c)
+            {
+                std::lock_guard<std::mutex> lock(s.depotMutex[c]);
+                while (Header* h = s.depot[c])
+                {
+                    s.depot[c] = h->next;
+                    std::free(h);
+                }
+                s.depotCount[c] = 0;
+            }
+        }
+
+        static void* ENET_CALLBACK enetMalloc(size_t size) { return allocate(size); }
+        static void ENET_CALLBACK enetFree(void* p) { release(p); }
+
+    private:
+        static constexpr int ClassCount = 9;        //32 bytes .. 8 KB
+        static constexpr uint32_t CacheLimit = 64;  //Blocks per class a thread keeps before spilling
+        static constexpr uint32_t TransferBatch = 32;
+
+        //16 bytes so the payload keeps malloc's alignment.
+        struct alignas(16) Header
+        {
+            union
+            {
+                Header* next;  //While free
+                size_t size;   //While allocated
+            };
+            int32_t sizeClass;
+        };
+
+        struct State
+        {
+            std::atomic<uint64_t> liveBytes{ 0 };
+            std::atomic<uint64_t> peakBytes{ 0 };
+            std::atomic<uint64_t> allocations{ 0 };
+            std::atomic<uint64_t> systemAllocations{ 0 };
+
+            std::mutex depotMutex[ClassCount];
+            Header* depot[ClassCount] = {};
+            uint32_t depotCount[ClassCount] = {};
+        };
+
+        struct ThreadCache
+        {
+            Header* heads[ClassCount] = {};
+            uint32_t counts[ClassCount] = {};
+
+            ~ThreadCache()
+            {
+                flushAll();
+                threadCacheGone() = true;
+            }
+
+            Header* pop(int c)
+            {
+                if (!heads[c])
+                {
+                    refill(c);
+                }
+
+                Header* h = heads[c];
+                if (h)
+                {
+                    heads[c] = h->next;
+                    --counts[c];
+                }
+                return h;
+            }
+
+            void push(Header* h)
+            {
+                int c = h->sizeClass;
+                h->next = heads[c];
+                heads[c] = h;
+
+                if (++counts[c] > CacheLimit)
+                {
+                    spill(c, TransferBatch);
+                }
+            }
+
+            void refill(int c)
+            {
+                State& s = state();
+                std::lock_guard<std::mutex> lock(s.depotMutex[c]);
+
+                for (uint32_t i = 0; i < TransferBatch && s.depot[c]; ++i)
+                {
+                    Header* h = s.depot[c];
+                    s.depot[c] = h->next;
+                    --s.depotCount[c];
+
+                    h->next = heads[c];
+                    heads[c] = h;
+                    ++counts[c];
+                }
+            }
+
+            void spill(int c, uint32_t n)
+            {
+                State& s = state();
+                std::lock_guard<std::mutex> lock(s.depotMutex[c]);
+
+                for (uint32_t i = 0; i < n && heads[c]; ++i)
+                {
+                    Header* h = heads[c];
+                    heads[c] = h->next;
+                    --counts[c];
+
+                    h->next = s.depot[c];
+                    s.depot[c] = h;
+                    ++s.depotCount[c];
+                }
+            }
+
+            void flushAll()
+            {
+                for (int c = 0; c < ClassCount; ++c)
+                {
+                    spill(c, counts[c]);
+                }
+            }
+        };
+
+        static size_t classSize(int c) { return size_t(32) << c; }
+
+        static int classFor(size_t size)
+        {
+            for (int c = 0; c < ClassCount; ++c)
+            {
+                if (size <= classSize(c))
+                {
+                    return c;
+                }
+            }
+            return -1;
+        }
+
+        //Never destroyed, thread caches may still flush into it during shutdown.
+        static State& state()
+        {
+            static State* s = new State();
+            return *s;
+        }
+
+        static ThreadCache& threadCache()
+        {
+            thread_local ThreadCache cache;
+            return cache;
+        }
+
+        //Set once this thread's cache has been destroyed (frees during thread/static teardown).
+        static bool& threadCacheGone()
+        {
+            thread_local bool gone = false;
+            return gone;
+        }
+
+        static void depotPush(Header* h)
+        {
+            State& s = state();
+            int c = h->sizeClass;
+            std::lock_guard<std::mutex> lock(s.depotMutex[c]);
+            h->next = s.depot[c];
+            s.depot[c] = h;
+            ++s.depotCount[c];
+        }
+    };
+
+    class Net 
+    {
+    public:
+        //Pooled installs NetAllocator, System plain malloc/free. Both are set explicitly because ENet keeps
+        //its callbacks across deinitialize, a System init after a Pooled one would otherwise stay pooled.
+        static bool Initialize(AllocatorPolicy policy = AllocatorPolicy::Pooled) 
+        {
+            ENetCallbacks callbacks;
+            std::memset(&callbacks, 0, sizeof(callbacks));
+            if (policy == AllocatorPolicy::Pooled)
+            {
+                callbacks.malloc = &NetAllocator::enetMalloc;
+                callbacks.free = &NetAllocator::enetFree;
+            }
+            else
+            {
+                callbacks.malloc = &systemMalloc;
+                callbacks.free = &systemFree;
+            }
+
+            int result = enet_initialize_with_callbacks(ENET_VERSION, &callbacks);
+            if (result != 0) 
+            {
+                std::cerr << "ENet initialization failed\n";
+                return false;
+            }
+
+            //Peak starts over with every Initialize/Deinitialize cycle.
+            NetAllocator::resetPeak();
+            return true;
+        }
+        static void Deinitialize() 
+        {
+            enet_deinitialize();
+            NetAllocator::trim();
+        }
+
+        //Live/peak bytes held through the pooled allocator, see AllocatorStats for what that covers.
+        static AllocatorStats GetAllocatorStats()
+        {
+            return NetAllocator::stats();
+        }
+
+    private:
+        static void* ENET_CALLBACK systemMalloc(size_t size) { return std::malloc(size); }
+        static void ENET_CALLBACK systemFree(void* p) { std::free(p); }
+    };
+
+    //Result of a Resolver lookup. Filled in by a worker thread, poll done() from the game thread.
+    class ResolveResult
+    {
+    public:
+        bool done() const { return state.load(std::memory_order_acquire) != Pending; }
+        bool succeeded() const { return state.load(std::memory_order_acquire) == Resolved; }
+
+        //Host in network byte order, valid once succeeded() is true.
+        enet_uint32 host() const { return address; }
+
+    private:
+        friend class Resolver;
+        enum State { Pending, Resolved, Failed };
+
+        void finish(bool ok, enet_uint32 h)
+        {
+            address = h;
+            state.store(ok ? Resolved : Failed, std::memory_order_release);
+        }
+
+        std::atomic<int> state{ Pending };
+        enet_uint32 address = 0;
+    };
+
+    //Hostname resolution off the game thread.
+    //Lookups run on a small worker pool and successful ones are cached for ttlMs. Static overrides
+    //(addStaticHost / loadHostsFile) win over DNS and never expire, which is handy for tests.
+    class Resolver
+    {
+    public:
+        explicit Resolver(size_t workerCount = 2, uint32_t ttlMs = 60000, uint32_t failureTtlMs = 5000)
+            : workerCount(workerCount ? workerCount : 1), ttlMs(ttlMs), failureTtlMs(failureTtlMs), stopping(false) {}
+
+        ~Resolver()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+            wake.notify_all();
+
+            for (std::thread& t : workers)
+            {
+                t.join();
+            }
+        }
+
+        Resolver(const Resolver&) = delete;
+        Resolver& operator=(const Resolver&) = delete;
+
+        //Shared instance used by NetClient unless told otherwise.
+        static Resolver& Shared()
+        {
+            static Resolver resolver;
+            return resolver;
+        }
+
+        void addStaticHost(const std::string& name, const std::string& ip)
+        {
+            ENetAddress address;
+            if (enet_address_set_host_ip(&address, ip.c_str()) != 0)
+            {
+                std::cerr << "Resolver: bad static address " << ip << " for " << name << "\n";
+                return;
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            staticHosts[name] = address.host;
+        }
+
+        //Reads an /etc/hosts style file: "ip name [aliases...]", # starts a comment.
+        bool loadHostsFile(const std::string& path)
+        {
+            std::ifstream in(path);
+            if (!in.is_open())
+            {
+                return false;
+            }
+
+            std::string line;
+            while (std::getline(in, line))
+            {
+                size_t hash = line.find('#');
+                if (hash != std::string::npos)
+                {
+                    line.erase(hash);
+                }
+
+                std::istringstream fields(line);
+                std::string ip, name;
+                if (!(fields >> ip))
+                {
+                    continue;
+                }
+
+                while (fields >> name)
+                {
+                    addStaticHost(name, ip);
+                }
+            }
+            return true;
+        }
+
+        //Answers from IP literals, static overrides and the cache only. Never blocks.
+        bool lookupCached(const std::string& name, enet_uint32& hostOut)
+        {
+            ENetAddress address;
+            if (enet_address_set_host_ip(&address, name.c_str()) == 0)
+            {
+                hostOut = address.host;
+                return true;
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            return lookupLocked(name, hostOut) == Hit;
+        }
+
+        //Starts a lookup on the worker pool. Cached names come back already done.
+        std::shared_ptr<const ResolveResult> resolveAsync(const std::string& name)
+        {
+            auto result = std::make_shared<ResolveResult>();
+
+            ENetAddress address;
+            if (enet_address_set_host_ip(&address, name.c_str()) == 0)
+            {
+                result->finish(true, address.host);
+                return result;
+            }
+
+            std::unique_lock<std::mutex> lock(mutex);
+
+            enet_uint32 host = 0;
+            Lookup cached = lookupLocked(name, host);
+            if (cached != Miss)
+            {
+                result->finish(cached == Hit, host);
+                return result;
+            }
+
+            //Someone already asked for this name, share their lookup.
+            auto inflight = inFlight.find(name);
+            if (inflight != inFlight.end())
+            {
+                return inflight->second;
+            }
+
+            inFlight[name] = result;
+            queue.push_back(name);
+
+            if (workers.size() < workerCount)
+            {
+                workers.emplace_back([this] { workerLoop(); });
+            }
+
+            lock.unlock();
+            wake.notify_one();
+
+            return result;
+        }
+
+        //Blocking lookup on the calling thread that still goes through, and fills, the cache.
+        bool resolveNow(const std::string& name, enet_uint32& hostOut)
+        {
+            if (lookupCached(name, hostOut))
+            {
+                return true;
+            }
+
+            ENetAddress address;
+            address.host = 0;
+            bool ok = enet_address_set_host(&address, name.c_str()) == 0;
+            store(name, ok, address.host);
+
+            hostOut = address.host;
+            return ok;
+        }
+
+        void clearCache()
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            cache.clear();
+        }
+
+    private:
+        using TimePoint = std::chrono::steady_clock::time_point;
+        enum Lookup { Hit, NegativeHit, Miss };
+
+        struct CacheEntry
+        {
+            bool ok = false;
+            enet_uint32 host = 0;
+            TimePoint expires;
+        };
+
+        Lookup lookupLocked(const std::string& name, enet_uint32& hostOut)
+        {
+            auto s = staticHosts.find(name);
+            if (s != staticHosts.end())
+            {
+                hostOut = s->second;
+                return Hit;
+            }
+
+            auto c = cache.find(name);
+            if (c == cache.end())
+            {
+                return Miss;
+            }
+
+            if (std::chrono::steady_clock::now() >= c->second.expires)
+            {
+                cache.erase(c);
+                return Miss;
+            }
+
+            hostOut = c->second.host;
+            return c->second.ok ? Hit : NegativeHit;
+        }
+
+        void store(const std::string& name, bool ok, enet_uint32 host)
+        {
+            CacheEntry entry;
+            entry.ok = ok;
+            entry.host = host;
+            entry.expires = std::chrono::steady_clock::now() + std::chrono::milliseconds(ok ? ttlMs : failureTtlMs);
+
+            std::lock_guard<std::mutex> lock(mutex);
+            cache[name] = entry;
+        }
+
+        void workerLoop()
+        {
+            for (;;)
+            {
+                std::string name;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    wake.wait(lock, [this] { return stopping || !queue.empty(); });
+
+                    if (stopping)
+                    {
+                        return;
+                    }
+
+                    name = std::move(queue.front());
+                    queue.pop_front();
+                }
+
+                //The slow part, getaddrinfo, runs without the lock held.
+                ENetAddress address;
+                address.host = 0;
+                bool ok = enet_address_set_host(&address, name.c_str()) == 0;
+                store(name, ok, address.host);
+
+                std::shared_ptr<ResolveResult> result;
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    auto it = inFlight.find(name);
+                    if (it != inFlight.end())
+                    {
+                        result = it->second;
+                        inFlight.erase(it);
+                    }
+                }
+
+                if (result)
+                {
+                    result->finish(ok, address.host);
+                }
+            }
+        }
+
+        const size_t workerCount;
+        const uint32_t ttlMs;
+        const uint32_t failureTtlMs;
+
+        std::mutex mutex;
+        std::condition_variable wake;
+        bool stopping;
+
+        std::vector<std::thread> workers;
+        std::deque<std::string> queue;
+        std::unordered_map<std::string, std::shared_ptr<ResolveResult>> inFlight;
+        std::unordered_map<std::string, CacheEntry> cache;
+        std::unordered_map<std::string, enet_uint32> staticHosts;
+    };
+
+    //When NetServer/NetClient hand queued sends to the socket.
+    enum class FlushPolicy
+    {
+        Immediate,  //Every send/broadcast flushes straight away. Lowest latency, at least one datagram per message
+        Coalesced   //Sends wait for the next service()/processReadable()/flush(), ENet packs them into as few datagrams as fit
+    };
+
+    //Datagram counters ENet keeps for a host. 32 bit, they wrap on long runs.
+    struct IoStats
+    {
+        uint32_t datagramsSent = 0;  //One socket send each
+        uint32_t datagramsReceived = 0;
+        uint32_t bytesSent = 0;
+        uint32_t bytesReceived = 0;
+
+        static IoStats of(const ENetHost* host)
+        {
+            IoStats s;
+            if (host)
+            {
+                s.datagramsSent = host->totalSentPackets;
+                s.datagramsReceived = host->totalReceivedPackets;
+                s.bytesSent = host->totalSentData;
+                s.bytesReceived = host->totalReceivedData;
+            }
+            return s;
+        }
+    };
+
+    //Batched I/O on ENet host sockets. Needs ENet built with enet/src/unix_batched.c in place of unix.c and
+    //SIMPLENET_ENET_BATCHING defined (Linux), everything in here does nothing with a stock ENet.
+    //What ENet sends in one service goes to the kernel in one sendmmsg, receives are read a batch at a time.
+    struct HostBatching
+    {
+        struct Stats
+        {
+            uint64_t datagramsSent = 0;
+            uint64_t sendCalls = 0;
+            uint64_t datagramsReceived = 0;
+            uint64_t receiveCalls = 0;
+            uint64_t sendErrors = 0;  //Refused by the kernel when a batch went out
+        };
+
+#ifdef SIMPLENET_HOST_BATCHING
+        static constexpr bool Available = true;
+
+        static void enable(ENetHost* host)
+        {
+            if (host && enet_socket_batch_enable(host->socket) < 0)
+            {
+                std::cerr << "Socket batching unavailable, host sends one datagram per syscall\n";
+            }
+        }
+
+        //Hands datagrams ENet queued on the socket to the kernel.
+        static void send(ENetHost* host) { enet_socket_batch_flush(host->socket); }
+
+        //Datagrams read from the kernel but not yet processed, a poll on the socket won't see them.
+        static bool pending(const ENetHost* host) { return enet_socket_batch_pending(host->socket) > 0; }
+
+        //All datagram sockets in the process, batched or not.
+        static Stats stats()
+        {
+            ENetSocketBatchStats raw;
+            enet_socket_batch_stats(&raw);
+            Stats s;
+            s.datagramsSent = raw.datagramsSent;
+            s.sendCalls = raw.sendCalls;
+            s.datagramsReceived = raw.datagramsReceived;
+            s.receiveCalls = raw.receiveCalls;
+            s.sendErrors = raw.sendErrors;
+            return s;
+        }
+#else
+        static constexpr bool Available = false;
+
+        static void enable(ENetHost*) {}
+        static void send(ENetHost*) {}
+        static bool pending(const ENetHost*) { return false; }
+        static Stats stats() { return Stats(); }
+#endif
+
+        //enet_host_flush, then out to the kernel.
+        static void flush(ENetHost* host)
+        {
+            enet_host_flush(host);
+            send(host);
+        }
+    };
+
+    //Sends and receives several datagrams per syscall on sockets SimpleNet owns itself (server browser and
+    //discovery), with sendmmsg/recvmmsg on Linux and one call per datagram elsewhere.
+    //Host sockets are batched by HostBatching instead.
+    class DatagramBatch
+    {
+    public:
+        static constexpr size_t MaxBatch = 64;
+
+        struct Outgoing
+        {
+            ENetAddress to;
+            const Packet* packet;
+            bool sent = false;  //Filled in by send
+        };
+
+        //Caller provides the buffer, size is filled in.
+        struct Incoming
+        {
+            ENetAddress from;
+            uint8_t* data;
+            size_t capacity;
+            size_t size;
+        };
+
+        struct Stats
+        {
+            uint64_t datagramsSent = 0;
+            uint64_t sendCalls = 0;
+            uint64_t datagramsReceived = 0;
+            uint64_t receiveCalls = 0;
+        };
+
+        //Returns how many datagrams were handed to the socket and marks each one's sent. A datagram the socket
+        //refuses (unreachable, would block) is skipped, the rest still go out.
+        static size_t send(ENetSocket socket, Outgoing* datagrams, size_t count)
+        {
+            size_t sent = 0;
+            size_t next = 0;
+#ifdef SIMPLENET_MMSG
+            while (next < count)
+            {
+                size_t n = std::min(count - next, MaxBatch);
+                mmsghdr msgs[MaxBatch];
+                iovec iov[MaxBatch];
+                sockaddr_in addrs[MaxBatch];
+                std::memset(msgs, 0, sizeof(mmsghdr) * n);
+
+                for (size_t i = 0; i < n; ++i)
+                {
+                    Outgoing& d = datagrams[next + i];
+                    d.sent = false;
+                    std::memset(&addrs[i], 0, sizeof(sockaddr_in));
+                    addrs[i].sin_family = AF_INET;
+                    addrs[i].sin_port = ENET_HOST_TO_NET_16(d.to.port);
+                    addrs[i].sin_addr.s_addr = d.to.host;
+                    iov[i].iov_base = const_cast<uint8_t*>(d.packet->data.data());
+                    iov[i].iov_len = d.packet->data.size();
+                    msgs[i].msg_hdr.msg_name = &addrs[i];
+                    msgs[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+                    msgs[i].msg_hdr.msg_iov = &iov[i];
+                    msgs[i].msg_hdr.msg_iovlen = 1;
+                }
+
+                int result = sendmmsg(socket, msgs, static_cast<unsigned>(n), MSG_NOSIGNAL);
+                counters().sendCalls.fetch_add(1, std::memory_order_relaxed);
+
+                //sendmmsg stops at the first datagram that fails, that one is skipped.
+                size_t accepted = result > 0 ? static_cast<size_t>(result) : 0;
+                for (size_t i = 0; i < accepted; ++i)
+                {
+                    datagrams[next + i].sent = true;
+                }
+                sent += accepted;
+                next += std::min(accepted + 1, n);
+                counters().datagramsSent.fetch_add(accepted, std::memory_order_relaxed);
+            }
+#else
+            for (; next < count; ++next)
+            {
+                Outgoing& d = datagrams[next];
+                ENetBuffer buffer;
+                buffer.data = const_cast<uint8_t*>(d.packet->data.data());
+                buffer.dataLength = d.packet->data.size();
+                counters().sendCalls.fetch_add(1, std::memory_order_relaxed);
+                d.sent = enet_socket_send(socket, &d.to, &buffer, 1) > 0;
+                if (d.sent)
+                {
+                    ++sent;
+                    counters().datagramsSent.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+#endif
+            return sent;
+        }
+
+        //Fills up to count slots with whatever is waiting, never blocks. Returns how many were filled.
+        static size_t receive(ENetSocket socket, Incoming* slots, size_t count)
+        {
+            count = std::min(count, MaxBatch);
+            if (count == 0)
+            {
+                return 0;
+            }
+#ifdef SIMPLENET_MMSG
+            mmsghdr msgs[MaxBatch];
+            iovec iov[MaxBatch];
+            sockaddr_in addrs[MaxBatch];
+            std::memset(msgs, 0, sizeof(mmsghdr) * count);
+
+            for (size_t i = 0; i < count; ++i)
+            {
+                iov[i].iov_base = slots[i].data;
+                iov[i].iov_len = slots[i].capacity;
+                msgs[i].msg_hdr.msg_name = &addrs[i];
+                msgs[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+                msgs[i].msg_hdr.msg_iov = &iov[i];
+                msgs[i].msg_hdr.msg_iovlen = 1;
+            }
+
+            int result = recvmmsg(socket, msgs, static_cast<unsigned>(count), MSG_DONTWAIT, nullptr);
+            counters().receiveCalls.fetch_add(1, std::memory_order_relaxed);
+            if (result <= 0)
+            {
+                return 0;
+            }
+
+            size_t filled = 0;
+            for (int i = 0; i < result; ++i)
+            {
+                //Truncated datagrams are not ours, everything SimpleNet sends here fits.
+                if (msgs[i].msg_hdr.msg_flags & MSG_TRUNC)
+                {
+                    continue;
+                }
+                //Swapping buffers rather than copying the slot, so every slot still owns a distinct one.
+                Incoming& slot = slots[filled++];
+                if (&slot != &slots[i])
+                {
+                    std::swap(slot.data, slots[i].data);
+                    std::swap(slot.capacity, slots[i].capacity);
+                }
+                slot.from.host = addrs[i].sin_addr.s_addr;
+                slot.from.port = ENET_NET_TO_HOST_16(addrs[i].sin_port);
+                slot.size = msgs[i].msg_len;
+            }
+            counters().datagramsReceived.fetch_add(filled, std::memory_order_relaxed);
+            return filled;
+#else
+            size_t filled = 0;
+            while (filled < count)
+            {
+                ENetBuffer buffer;
+                buffer.data = slots[filled].data;
+                buffer.dataLength = slots[filled].capacity;
+                int received = enet_socket_receive(socket, &slots[filled].from, &buffer, 1);
+                counters().receiveCalls.fetch_add(1, std::memory_order_relaxed);
+                if (received <= 0)
+                {
+                    break;
+                }
+                slots[filled++].size = static_cast<size_t>(received);
+            }
+            counters().datagramsReceived.fetch_add(filled, std::memory_order_relaxed);
+            return filled;
+#endif
+        }
+
+        //Process wide totals, for checking how many syscalls batching saved.
+        static Stats stats()
+        {
+            Stats s;
+            s.datagramsSent = counters().datagramsSent.load(std::memory_order_relaxed);
+            s.sendCalls = counters().sendCalls.load(std::memory_order_relaxed);
+            s.datagramsReceived = counters().datagramsReceived.load(std::memory_order_relaxed);
+            s.receiveCalls = counters().receiveCalls.load(std::memory_order_relaxed);
+            return s;
+        }
+
+    private:
+        //Browsers and servers can run on different threads, so the totals are atomic.
+        struct Counters
+        {
+            std::atomic<uint64_t> datagramsSent{ 0 };
+            std::atomic<uint64_t> sendCalls{ 0 };
+            std::atomic<uint64_t> datagramsReceived{ 0 };
+            std::atomic<uint64_t> receiveCalls{ 0 };
+        };
+
+        static Counters& counters()
+        {
+            static Counters instance;
+            return instance;
+        }
+    };
+
+    //What a server advertises to LAN discovery.
+    struct ServerInfo
+    {
+        ENetAddress address = { 0, 0 }; //Filled in by the client from where the reply came from
+        uint16_t port = 0;
+        uint16_t playerCount = 0;
+        uint16_t maxPlayers = 0;
+        uint16_t tickRate = 0;    //Simulation ticks per second
+        uint8_t load = 0;         //0-255, how busy the server says it is
+        uint32_t instance = 0;    //Random per server process, filled in from the reply
+    };
+
+    //Discovery wire format, shared by NetServer (answers) and LanDiscovery (asks).
+    //Every datagram starts with Magic, Version, Type and a nonce the answer echoes back.
+    struct DiscoveryProtocol
+    {
+        static constexpr uint16_t DefaultPort = 47776;
+        static constexpr uint32_t Magic = 0x504E5353; //"SSNP"
+        static constexpr uint8_t Version = 2;
+        static constexpr size_t MaxDatagram = 64;
+
+        enum Type : uint8_t
+        {
+            Probe = 1, //Broadcast to the discovery port
+            Reply = 2,
+            Ping = 3,  //Sent straight to a server's game port, answered through ENet's intercept hook
+            Pong = 4
+        };
+
+        static Packet makeProbe(uint32_t nonce)
+        {
+            Packet p;
+            writeHeader(p, Probe, nonce);
+            return p;
+        }
+
+        static Packet makePing(uint32_t nonce)
+        {
+            Packet p;
+            writeHeader(p, Ping, nonce);
+            return p;
+        }
+
+        //Reply and Pong carry the same body.
+        static Packet makeReply(uint32_t nonce, const ServerInfo& info, Type type = Reply)
+        {
+            Packet p;
+            writeHeader(p, type, nonce);
+            p.appendPOD(info.port);
+            p.appendPOD(info.playerCount);
+            p.appendPOD(info.maxPlayers);
+            p.appendPOD(info.tickRate);
+            p.appendPOD(info.load);
+            p.appendPOD(processInstance());
+            return p;
+        }
+
+        static bool readHeader(PacketReader& r, uint8_t& type, uint32_t& nonce)
+        {
+            uint32_t magic = 0;
+            uint8_t version = 0;
+            return r.readPOD(magic) && magic == Magic && r.readPOD(version) && version == Version && r.readPOD(type) && r.readPOD(nonce);
+        }
+
+        static bool readReply(PacketReader& r, ServerInfo& info)
+        {
+            return r.readPOD(info.port) && r.readPOD(info.playerCount) && r.readPOD(info.maxPlayers) && r.readPOD(info.tickRate) && r.readPOD(info.load) && r.readPOD(info.instance);
+        }
+
+        //Picked once per process, so a client can tell one server answering on two addresses (broadcast and
+        //loopback) from two servers that happen to use the same port.
+        static uint32_t processInstance()
+        {
+            static const uint32_t id = []
+            {
+                std::random_device rd;
+                uint32_t v = rd() ^ enet_time_get();
+                return v ? v : 1u;
+            }();
+            return id;
+        }
+
+        static bool sendTo(ENetSocket socket, const ENetAddress& to, const Packet& p)
+        {
+            ENetBuffer buffer;
+            buffer.data = const_cast<uint8_t*>(p.data.data());
+            buffer.dataLength = p.data.size();
+            return enet_socket_send(socket, &to, &buffer, 1) > 0;
+        }
+
+    private:
+        static void writeHeader(Packet& p, Type type, uint32_t nonce)
+        {
+            p.data.reserve(MaxDatagram);
+            p.appendPOD(Magic);
+            p.appendPOD(Version);
+            p.appendPOD(static_cast<uint8_t>(type));
+            p.appendPOD(nonce);
+        }
+    };
+
+    //Outgoing queue limits for NetServer/NetClient, see setBackpressure. highWater 0 means off.
+    struct Backpressure
+    {
+        size_t highWater = 0;
+        size_t lowWater = 0;
+
+        //Bytes ENet is holding for peer: queued and not sent yet, plus reliable data sent but not acked.
+        //Walks the peer's command lists, so it costs one step per queued command (fragments count separately).
+        static size_t queuedBytes(ENetPeer* peer)
+        {
+            size_t total = 0;
+            ENetList* lists[] = { &peer->outgoingCommands, &peer->outgoingSendReliableCommands, &peer->sentReliableCommands };
+
+            for (ENetList* list : lists)
+            {
+                for (ENetListIterator it = enet_list_begin(list); it != enet_list_end(list); it = enet_list_next(it))
+                {
+                    const ENetOutgoingCommand* command = reinterpret_cast<const ENetOutgoingCommand*>(it);
+                    if (command->packet)
+                    {
+                        total += command->fragmentLength;
+                    }
+                }
+            }
+            return total;
+        }
+    };
+
+    struct ServiceStats
+    {
+        uint64_t calls = 0;
+        uint64_t events = 0;          //Handed to callbacks
+        uint64_t limitedCalls = 0;    //Calls that stopped on maxEvents or budgetUs
+        uint64_t deferredEvents = 0;  //Events left queued by those calls, summed over calls
+        uint32_t lastDeferred = 0;    //Left queued by the last call
+    };
+
+    //Limits for one NetServer/NetClient::service call, so a flood of traffic cannot hold the caller up.
+    //Events over the limits stay queued inside ENet and come out first on the next call.
+    struct ServiceOptions
+    {
+        uint32_t timeoutMs = 0;  //How long to wait for the first event
+        uint32_t maxEvents = 0;  //0 is no limit
+        uint32_t budgetUs = 0;   //Wall clock for the call, 0 is no limit. Checked between events
+
+        //Runs ENet once (sends, receives, timeouts), then hands out what it queued with enet_host_check_events.
+        //Goes back to the socket when the queue runs dry, until nothing is left or a limit is hit.
+        template<typename Dispatch>
+        static void drain(ENetHost* host, const ServiceOptions& options, ServiceStats& stats, Dispatch&& dispatch)
+        {
+            const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            const std::chrono::microseconds budget(options.budgetUs);
+            uint32_t handled = 0;
+            bool limited = false;
+
+            ENetEvent event;
+            int result = enet_host_service(host, &event, options.timeoutMs);
+            while (result > 0)
+            {
+                dispatch(event);
+                ++handled;
+
+                if ((options.maxEvents && handled >= options.maxEvents) ||
+                    (options.budgetUs && std::chrono::steady_clock::now() - start >= budget))
+                {
+                    limited = true;
+                    break;
+                }
+
+                result = enet_host_check_events(host, &event);
+                if (result == 0)
+                {
+                    result = enet_host_service(host, &event, 0);
+                }
+            }
+
+            //enet_host_service can return without reaching the socket again after its last send.
+            HostBatching::send(host);
+
+            ++stats.calls;
+            stats.events += handled;
+            stats.lastDeferred = 0;
+            if (limited)
+            {
+                stats.lastDeferred = static_cast<uint32_t>(queuedEvents(host));
+                stats.deferredEvents += stats.lastDeferred;
+                ++stats.limitedCalls;
+            }
+        }
+
+        //Milliseconds until ENet has protocol work to do on host (resends, pings, acks, throttle), capped at maxMs.
+        //0 when something is ready now. For waiting on the host's socket in your own poll/epoll loop.
+        static uint32_t nextTimeoutMs(ENetHost* host, uint32_t maxMs)
+        {
+            if (queuedEvents(host) || HostBatching::pending(host))
+            {
+                return 0;
+            }
+
+            enet_uint32 now = enet_time_get();
+            uint32_t wait = maxMs;
+            auto until = [&](enet_uint32 when)
+            {
+                int32_t left = static_cast<int32_t>(when - now);
+                wait = std::min<uint32_t>(wait, left > 0 ? static_cast<uint32_t>(left) : 0);
+            };
+
+            for (ENetPeer* peer = host->peers; peer < host->peers + host->peerCount; ++peer)
+            {
+                if (peer->state == ENET_PEER_STATE_DISCONNECTED || peer->state == ENET_PEER_STATE_ZOMBIE)
+                {
+                    continue;
+                }
+
+                //Acks go out on the next service. Queued sends too, unless they are waiting on acks for
+                //data already in flight, then the ack or the resend timer wakes things up.
+                bool inFlight = !enet_list_empty(&peer->sentReliableCommands);
+                if (!enet_list_empty(&peer->acknowledgements) ||
+                    (!inFlight && (!enet_list_empty(&peer->outgoingCommands) || !enet_list_empty(&peer->outgoingSendReliableCommands))))
+                {
+                    return 0;
+                }
+
+                if (inFlight)
+                {
+                    until(peer->nextTimeout);
+                }
+                else if (peer->state == ENET_PEER_STATE_CONNECTED)
+                {
+                    until(peer->lastReceiveTime + peer->pingInterval);
+                }
+            }
+
+            if (host->bandwidthLimitedPeers || host->incomingBandwidth || host->outgoingBandwidth)
+            {
+                until(host->bandwidthThrottleEpoch + ENET_HOST_BANDWIDTH_THROTTLE_INTERVAL);
+            }
+            return wait;
+        }
+
+        //Events ENet has ready to hand out without touching the socket. Walks the host's dispatch queue.
+        static size_t queuedEvents(ENetHost* host)
+        {
+            size_t total = 0;
+            for (ENetListIterator it = enet_list_begin(&host->dispatchQueue); it != enet_list_end(&host->dispatchQueue); it = enet_list_next(it))
+            {
+                const ENetPeer* peer = reinterpret_cast<const ENetPeer*>(it);
+                switch (peer->state)
+                {
+                case ENET_PEER_STATE_CONNECTION_PENDING:
+                case ENET_PEER_STATE_CONNECTION_SUCCEEDED:
+                case ENET_PEER_STATE_ZOMBIE:
+                    ++total;
+                    break;
+                default:
+                    for (ENetListIterator c = enet_list_begin(&peer->dispatchedCommands); c != enet_list_end(&peer->dispatchedCommands); c = enet_list_next(c))
+                    {
+                        ++total;
+                    }
+                    break;
+                }
+            }
+            return total;
+        }
+    };
+
+    //Datagram compression, set with NetServer/NetClient::setCompression. Both ends must pick the same one,
+    //ENet only flags that a datagram was compressed, not how.
+    enum class Compression
+    {
+        None,
+        RangeCoder, //ENet's adaptive range coder. Best ratio, slowest
+        Lz,         //Bundled LZ77 codec. Fast, good on repeated fields and strings
+        Trained     //Static model trained on captured traffic (see TrainedModel), for small datagrams
+    };
+
+    struct CompressionStats
+    {
+        uint64_t datagrams = 0;     //Handed to the compressor
+        uint64_t compressed = 0;    //Came out smaller and were sent compressed
+        uint64_t skipped = 0;       //Not tried: too small, or compression has not been paying off lately
+        uint64_t bytesIn = 0;       //Sizes of the datagrams that were tried
+        uint64_t bytesOut = 0;      //What those went out as, compressed or not
+        uint64_t compressNs = 0;
+        uint64_t decompressed = 0;
+        uint64_t decompressNs = 0;
+
+        //Sent size over original size for datagrams that were tried, lower is better.
+        double ratio() const { return bytesIn ? static_cast<double>(bytesOut) / bytesIn : 1.0; }
+    };
+
+    //A codec plugged into PacketCompressor. Both calls return 0 on failure, or when the output would not
+    //fit, in which case ENet sends the datagram uncompressed.
+    class PacketCodec
+    {
+    public:
+        virtual ~PacketCodec() = default;
+        virtual size_t compress(const ENetBuffer* in, size_t inCount, size_t inLimit, uint8_t* out, size_t outLimit) = 0;
+        virtual size_t decompress(const uint8_t* in, size_t inLimit, uint8_t* out, size_t outLimit) = 0;
+
+    protected:
+        //Copies scattered ENet buffers into one block, ENet datagrams are never bigger than the MTU.
+        static size_t gather(const ENetBuffer* in, size_t inCount, size_t inLimit, uint8_t* out)
+        {
+            size_t total = 0;
+            for (size_t i = 0; i < inCount && total < inLimit; ++i)
+            {
+                size_t n = std::min(in[i].dataLength, inLimit - total);
+                std::memcpy(out + total, in[i].data, n);
+                total += n;
+            }
+            return total;
+        }
+    };
+
+    class RangeCoderCodec : public PacketCodec
+    {
+    public:
+        RangeCoderCodec() : coder(enet_range_coder_create()) {}
+        ~RangeCoderCodec() override { enet_range_coder_destroy(coder); }
+
+        bool valid() const { return coder != nullptr; }
+
+        size_t compress(const ENetBuffer* in, size_t inCount, size_t inLimit, uint8_t* out, size_t outLimit) override
+        {
+            return enet_range_coder_compress(coder, in, inCount, inLimit, out, outLimit);
+        }
+
+        size_t decompress(const uint8_t* in, size_t inLimit, uint8_t* out, size_t outLimit) override
+        {
+            return enet_range_coder_decompress(coder, in, inLimit, out, outLimit);
+        }
+
+    private:
+        void* coder;
+    };
+
+    //Byte-aligned LZ77 in the style of LZ4, sized for single datagrams (offsets fit in 16 bits).
+    //A sequence is [token][extra literal length][literals][u16 offset][extra match length], the token holds
+    //the literal length in the high nibble and match length - 4 in the low one, 15 meaning more bytes follow.
+    //The last sequence is literals only and ends the block.
+    class LzCodec : public PacketCodec
+    {
+    public:
+        size_t compress(const ENetBuffer* in, size_t inCount, size_t inLimit, uint8_t* out, size_t outLimit) override
+        {
+            size_t n = gather(in, inCount, std::min<size_t>(inLimit, sizeof(scratch)), scratch);
+            return compressBlock(scratch, n, out, outLimit);
+        }
+
+        size_t decompress(const uint8_t* in, size_t inLimit, uint8_t* out, size_t outLimit) override
+        {
+            return decompressBlock(in, inLimit, out, outLimit);
+        }
+
+        static size_t compressBlock(const uint8_t* src, size_t n, uint8_t* dst, size_t cap)
+        {
+            if (n == 0)
+            {
+                return 0;
+            }
+
+            uint16_t table[HashSize];
+            std::memset(table, 0, sizeof(table));
+
+            size_t ip = 0;
+            size_t anchor = 0;
+            size_t op = 0;
+
+            while (n >= MinMatch && ip <= n - MinMatch)
+            {
+                uint32_t h = hash(src + ip);
+                size_t ref = table[h];
+                table[h] = static_cast<uint16_t>(ip + 1);
+
+                if (ref == 0 || std::memcmp(src + ref - 1, src + ip, MinMatch) != 0)
+                {
+                    ++ip;
+                    continue;
+                }
+                --ref;
+
+                size_t length = MinMatch;
+                while (ip + length < n && src[ref + length] == src[ip + length])
+                {
+                    ++length;
+                }
+
+                if (!writeSequence(src + anchor, ip - anchor, static_cast<uint16_t>(ip - ref), length, dst, op, cap))
+                {
+                    return 0;
+                }
+
+                ip += length;
+                anchor = ip;
+            }
+
+            if (!writeSequence(src + anchor, n - anchor, 0, 0, dst, op, cap))
+            {
+                return 0;
+            }
+            return op;
+        }
+
+        static size_t decompressBlock(const uint8_t* src, size_t n, uint8_t* dst, size_t cap)
+        {
+            size_t ip = 0;
+            size_t op = 0;
+
+            while (ip < n)
+            {
+                uint8_t token = src[ip++];
+
+                size_t literals = token >> 4;
+                if (literals == 15 && !readLength(src, n, ip, literals))
+                {
+                    return 0;
+                }
+                if (literals > n - ip || literals > cap - op)
+                {
+                    return 0;
+                }
+                std::memcpy(dst + op, src + ip, literals);
+                ip += literals;
+                op += literals;
+
+                if (ip == n)
+                {
+                    return op;
+                }
+
+                if (n - ip < 2)
+                {
+                    return 0;
+                }
+                size_t offset = src[ip] | (src[ip + 1] << 8);
+                ip += 2;
+
+                size_t length = token & 15;
+                if (length == 15 && !readLength(src, n, ip, length))
+                {
+                    return 0;
+                }
+                length += MinMatch;
+
+                if (offset == 0 || offset > op || length > cap - op)
+                {
+                    return 0;
+                }
+
+                //Byte by byte, matches may overlap what they are writing.
+                const uint8_t* from = dst + op - offset;
+                for (size_t i = 0; i < length; ++i)
+                {
+                    dst[op + i] = from[i];
+                }
+                op += length;
+            }
+            return 0;
+        }
+
+    private:
+        static constexpr size_t MinMatch = 4;
+        static constexpr size_t HashBits = 11;
+        static constexpr size_t HashSize = size_t(1) << HashBits;
+
+        static uint32_t hash(const uint8_t* p)
+        {
+            uint32_t v;
+            std::memcpy(&v, p, sizeof(v));
+            return (v * 2654435761u) >> (32 - HashBits);
+        }
+
+        static bool writeLength(size_t length, uint8_t* dst, size_t& op, size_t cap)
+        {
+            for (; length >= 255; length -= 255)
+            {
+                if (op == cap) return false;
+                dst[op++] = 255;
+            }
+            if (op == cap) return false;
+            dst[op++] = static_cast<uint8_t>(length);
+            return true;
+        }
+
+        static bool readLength(const uint8_t* src, size_t n, size_t& ip, size_t& length)
+        {
+            uint8_t b;
+            do
+            {
+                if (ip == n) return false;
+                b = src[ip++];
+                length += b;
+            } while (b == 255);
+            return true;
+        }
+
+        //matchLength 0 writes the final literals-only sequence.
+        static bool writeSequence(const uint8_t* literals, size_t literalCount, uint16_t offset, size_t matchLength, uint8_t* dst, size_t& op, size_t cap)
+        {
+            if (op == cap)
+            {
+                return false;
+            }
+
+            size_t matchCode = matchLength ? matchLength - MinMatch : 0;
+            dst[op++] = static_cast<uint8_t>((std::min<size_t>(literalCount, 15) << 4) | std::min<size_t>(matchCode, 15));
+
+            if (literalCount >= 15 && !writeLength(literalCount - 15, dst, op, cap))
+            {
+                return false;
+            }
+            if (literalCount > cap - op)
+            {
+                return false;
+            }
+            std::memcpy(dst + op, literals, literalCount);
+            op += literalCount;
+
+            if (!matchLength)
+            {
+                return true;
+            }
+
+            if (cap - op < 2)
+            {
+                return false;
+            }
+            dst[op++] = static_cast<uint8_t>(offset);
+            dst[op++] = static_cast<uint8_t>(offset >> 8);
+
+            return matchCode < 15 || writeLength(matchCode - 15, dst, op, cap);
+        }
+
+        uint8_t scratch[ENET_PROTOCOL_MAXIMUM_MTU];
+    };
+
+    //Recorded datagrams for training a TrainedModel, as handed to the compressor (ENet header stripped).
+    //File format: [u32 magic][u8 version] then records of [u16 length][bytes].
+    class TrafficCapture
+    {
+    public:
+        static constexpr uint32_t Magic = 0x50434E53; //"SNCP"
+        static constexpr uint8_t Version = 1;
+
+        bool open(const std::string& path)
+        {
+            out.open(path, std::ios::binary | std::ios::trunc);
+            if (!out)
+            {
+                std::cerr << "Failed to open capture file " << path << "\n";
+                return false;
+            }
+
+            out.write(reinterpret_cast<const char*>(&Magic), sizeof(Magic));
+            out.write(reinterpret_cast<const char*>(&Version), sizeof(Version));
+            return true;
+        }
+
+        void record(const uint8_t* data, size_t size)
+        {
+            uint16_t length = static_cast<uint16_t>(size);
+            out.write(reinterpret_cast<const char*>(&length), sizeof(length));
+            out.write(reinterpret_cast<const char*>(data), length);
+        }
+
+        //Reads every datagram in a capture file. Returns false if it is missing or not a capture.
+        static bool readAll(const std::string& path, std::vector<std::vector<uint8_t>>& datagrams)
+        {
+            std::ifstream in(path, std::ios::binary);
+            uint32_t magic = 0;
+            uint8_t version = 0;
+            if (!in.read(reinterpret_cast<char*>(&magic), sizeof(magic)) || !in.read(reinterpret_cast<char*>(&version), sizeof(version))
+                || magic != Magic || version != Version)
+            {
+                std::cerr << path << " is not a SimpleNet capture\n";
+                return false;
+            }
+
+            uint16_t length = 0;
+            while (in.read(reinterpret_cast<char*>(&length), sizeof(length)))
+            {
+                std::vector<uint8_t> d(length);
+                if (!in.read(reinterpret_cast<char*>(d.data()), length))
+                {
+                    break;
+                }
+                datagrams.push_back(std::move(d));
+            }
+            return true;
+        }
+
+    private:
+        std::ofstream out;
+    };
+
+    //Order-1 static model for TrainedCodec: for every previous byte, the frequencies of the next one,
+    //normalized to 2^ScaleBits with every byte possible. Built by Tools/TrafficTrainer from captures and
+    //loaded on both ends, it already knows what game datagrams look like, which is what lets it shrink
+    //packets far too small for adaptive coders to learn anything from.
+    class TrainedModel
+    {
+    public:
+        static constexpr uint32_t Magic = 0x4D544E53; //"SNTM"
+        static constexpr uint8_t Version = 1;
+        static constexpr uint32_t ScaleBits = 12;
+        static constexpr uint32_t Scale = 1u << ScaleBits;
+        static constexpr size_t Symbols = 256;
+
+        //counts[context * 256 + symbol] is how often symbol followed context (context 0 also starts datagrams).
+        static std::shared_ptr<TrainedModel> fromCounts(const std::vector<uint64_t>& counts)
+        {
+            if (counts.size() != Symbols * Symbols)
+            {
+                return nullptr;
+            }
+
+            std::shared_ptr<TrainedModel> model(new TrainedModel());
+            for (size_t ctx = 0; ctx < Symbols; ++ctx)
+            {
+                const uint64_t* row = &counts[ctx * Symbols];
+                uint64_t total = 0;
+                size_t top = 0;
+                for (size_t sym = 0; sym < Symbols; ++sym)
+                {
+                    total += row[sym];
+                    top = row[sym] > row[top] ? sym : top;
+                }
+
+                //Every byte gets at least 1 so anything can be coded, the rest is shared by count and what
+                //rounding leaves over goes to the most common byte.
+                uint32_t assigned = 0;
+                for (size_t sym = 0; sym < Symbols; ++sym)
+                {
+                    uint32_t f = 1;
+                    if (total)
+                    {
+                        f += static_cast<uint32_t>(row[sym] * (Scale - Symbols) / total);
+                    }
+                    else
+                    {
+                        f = Scale / Symbols;
+                    }
+                    model->freqs[ctx * Symbols + sym] = static_cast<uint16_t>(f);
+                    assigned += f;
+                }
+                model->freqs[ctx * Symbols + top] = static_cast<uint16_t>(model->freqs[ctx * Symbols + top] + (Scale - assigned));
+            }
+
+            model->buildStarts();
+            return model;
+        }
+
+        static std::shared_ptr<TrainedModel> load(const std::string& path)
+        {
+            std::ifstream in(path, std::ios::binary);
+            uint32_t magic = 0;
+            uint8_t version = 0;
+            if (!in.read(reinterpret_cast<char*>(&magic), sizeof(magic)) || !in.read(reinterpret_cast<char*>(&version), sizeof(version))
+                || magic != Magic || version != Version)
+            {
+                std::cerr << "Failed to load compression model " << path << "\n";
+                return nullptr;
+            }
+
+            std::shared_ptr<TrainedModel> model(new TrainedModel());
+            if (!in.read(reinterpret_cast<char*>(model->freqs.data()), model->freqs.size() * sizeof(uint16_t)))
+            {
+                std::cerr << "Compression model " << path << " is truncated\n";
+                return nullptr;
+            }
+
+            //Each context has to add up exactly, or encoder and decoder would disagree.
+            for (size_t ctx = 0; ctx < Symbols; ++ctx)
+            {
+                uint32_t total = 0;
+                for (size_t sym = 0; sym < Symbols; ++sym)
+                {
+                    uint16_t f = model->freqs[ctx * Symbols + sym];
+                    if (f == 0)
+                    {
+                        total = 0;
+                        break;
+                    }
+                    total += f;
+                }
+                if (total != Scale)
+                {
+                    std::cerr << "Compression model " << path << " is corrupt\n";
+                    return nullptr;
+                }
+            }
+
+            model->buildStarts();
+            return model;
+        }
+
+        bool save(const std::string& path) const
+        {
+            std::ofstream out(path, std::ios::binary | std::ios::trunc);
+            out.write(reinterpret_cast<const char*>(&Magic), sizeof(Magic));
+            out.write(reinterpret_cast<const char*>(&Version), sizeof(Version));
+            out.write(reinterpret_cast<const char*>(freqs.data()), freqs.size() * sizeof(uint16_t));
+            return static_cast<bool>(out);
+        }
+
+        uint32_t freq(uint8_t ctx, uint8_t sym) const { return freqs[ctx * Symbols + sym]; }
+        uint32_t start(uint8_t ctx, uint8_t sym) const { return starts[ctx * (Symbols + 1) + sym]; }
+
+        //The byte whose [start, start + freq) range holds slot.
+        uint8_t find(uint8_t ctx, uint32_t slot) const
+        {
+            const uint16_t* row = &starts[ctx * (Symbols + 1)];
+            size_t lo = 0;
+            size_t hi = Symbols;
+            while (hi - lo > 1)
+            {
+                size_t mid = (lo + hi) / 2;
+                if (row[mid] <= slot)
+                {
+                    lo = mid;
+                }
+                else
+                {
+                    hi = mid;
+                }
+            }
+            return static_cast<uint8_t>(lo);
+        }
+
+    private:
+        TrainedModel() : freqs(Symbols * Symbols), starts(Symbols * (Symbols + 1)) {}
+
+        void buildStarts()
+        {
+            for (size_t ctx = 0; ctx < Symbols; ++ctx)
+            {
+                uint32_t sum = 0;
+                for (size_t sym = 0; sym <= Symbols; ++sym)
+                {
+                    starts[ctx * (Symbols + 1) + sym] = static_cast<uint16_t>(sum);
+                    if (sym < Symbols)
+                    {
+                        sum += freqs[ctx * Symbols + sym];
+                    }
+                }
+            }
+        }
+
+        std::vector<uint16_t> freqs;
+        std::vector<uint16_t> starts;
+    };
+
+    //rANS coder over a TrainedModel. Output is [u16 original size][4 byte state][renormalization bytes].
+    class TrainedCodec : public PacketCodec
+    {
+    public:
+        explicit TrainedCodec(std::shared_ptr<const TrainedModel> model) : model(std::move(model)) {}
+
+        size_t compress(const ENetBuffer* in, size_t inCount, size_t inLimit, uint8_t* out, size_t outLimit) override
+        {
+            size_t n = gather(in, inCount, std::min<size_t>(inLimit, sizeof(scratch)), scratch);
+            return compressBlock(*model, scratch, n, out, outLimit);
+        }
+
+        size_t decompress(const uint8_t* in, size_t inLimit, uint8_t* out, size_t outLimit) override
+        {
+            return decompressBlock(*model, in, inLimit, out, outLimit);
+        }
+
+        static size_t compressBlock(const TrainedModel& m, const uint8_t* src, size_t n, uint8_t* dst, size_t cap)
+        {
+            if (n == 0 || n > UINT16_MAX || cap < HeaderSize)
+            {
+                return 0;
+            }
+
+            //rANS encodes back to front, so the stream is built from the end of the buffer.
+            uint8_t stream[ENET_PROTOCOL_MAXIMUM_MTU];
+            uint8_t* end = stream + std::min<size_t>(sizeof(stream), cap - HeaderSize + StateSize);
+            uint8_t* ptr = end;
+            uint32_t x = Low;
+
+            for (size_t i = n; i-- > 0;)
+            {
+                uint8_t ctx = i ? src[i - 1] : 0;
+                uint32_t f = m.freq(ctx, src[i]);
+                uint32_t xMax = ((Low >> TrainedModel::ScaleBits) << 8) * f;
+                while (x >= xMax)
+                {
+                    if (ptr == stream)
+                    {
+                        return 0;
+                    }
+                    *--ptr = static_cast<uint8_t>(x);
+                    x >>= 8;
+                }
+                x = ((x / f) << TrainedModel::ScaleBits) + (x % f) + m.start(ctx, src[i]);
+            }
+
+            if (ptr - stream < static_cast<ptrdiff_t>(StateSize))
+            {
+                return 0;
+            }
+            ptr -= StateSize;
+            for (size_t k = 0; k < StateSize; ++k)
+            {
+                ptr[k] = static_cast<uint8_t>(x >> (8 * k));
+            }
+
+            size_t size = static_cast<size_t>(end - ptr);
+            if (sizeof(uint16_t) + size > cap)
+            {
+                return 0;
+            }
+
+            dst[0] = static_cast<uint8_t>(n);
+            dst[1] = static_cast<uint8_t>(n >> 8);
+            std::memcpy(dst + sizeof(uint16_t), ptr, size);
+            return sizeof(uint16_t) + size;
+        }
+
+        static size_t decompressBlock(const TrainedModel& m, const uint8_t* src, size_t inLimit, uint8_t* dst, size_t cap)
+        {
+            if (inLimit < HeaderSize)
+            {
+                return 0;
+            }
+
+            size_t n = src[0] | (src[1] << 8);
+            if (n == 0 || n > cap)
+            {
+                return 0;
+            }
+
+            size_t ip = sizeof(uint16_t);
+            uint32_t x = 0;
+            for (size_t k = 0; k < StateSize; ++k)
+            {
+                x |= static_cast<uint32_t>(src[ip++]) << (8 * k);
+            }
+
+            for (size_t i = 0; i < n; ++i)
+            {
+                uint8_t ctx = i ? dst[i - 1] : 0;
+                uint32_t slot = x & (TrainedModel::Scale - 1);
+                uint8_t sym = m.find(ctx, slot);
+                dst[i] = sym;
+
+                x = m.freq(ctx, sym) * (x >> TrainedModel::ScaleBits) + slot - m.start(ctx, sym);
+                while (x < Low)
+                {
+                    if (ip == inLimit)
+                    {
+                        return 0;
+                    }
+                    x = (x << 8) | src[ip++];
+                }
+            }
+
+            //A clean stream ends back at the starting state with nothing left over.
+            return (x == Low && ip == inLimit) ? n : 0;
+        }
+
+    private:
+        static constexpr uint32_t Low = 1u << 23;
+        static constexpr size_t StateSize = 4;
+        static constexpr size_t HeaderSize = sizeof(uint16_t) + StateSize;
+
+        std::shared_ptr<const TrainedModel> model;
+        uint8_t scratch[ENET_PROTOCOL_MAXIMUM_MTU];
+    };
+
+    //Everything setCompression/setCompressionModel/captureTraffic set up on a host.
+    struct CompressionConfig
+    {
+        Compression mode = Compression::None;
+        std::shared_ptr<const TrainedModel> model;  //For Compression::Trained
+        std::string capturePath;                    //Record outgoing datagrams here for training
+    };
+
+    //The ENetCompressor context SimpleNet installs on its hosts. Wraps a codec with stats, and skips
+    //datagrams that are unlikely to shrink: anything under minSize, and for a while after several tries in
+    //a row saved less than 5%. Payloads that are already compressed or encrypted stop costing CPU that way.
+    class PacketCompressor
+    {
+    public:
+        static constexpr size_t DefaultMinSize = 24;
+        static constexpr uint32_t MissesBeforeBackoff = 8;
+        static constexpr uint32_t BackoffDatagrams = 64;
+
+        explicit PacketCompressor(std::unique_ptr<PacketCodec> codec, size_t minSize = DefaultMinSize)
+            : codec(std::move(codec)), minSize(minSize), misses(0), skipLeft(0) {}
+
+        //Installs a compressor for config on h, or removes it if there is nothing to do.
+        static bool install(ENetHost* h, const CompressionConfig& config)
+        {
+            std::unique_ptr<PacketCodec> codec;
+            switch (config.mode)
+            {
+            case Compression::None:
+                if (config.capturePath.empty())
+                {
+                    enet_host_compress(h, NULL);
+                    return true;
+                }
+                break;
+            case Compression::RangeCoder:
+            {
+                std::unique_ptr<RangeCoderCodec> rc(new RangeCoderCodec());
+                if (!rc->valid())
+                {
+                    return false;
+                }
+                codec = std::move(rc);
+                break;
+            }
+            case Compression::Lz:
+                codec.reset(new LzCodec());
+                break;
+            case Compression::Trained:
+                if (!config.model)
+                {
+                    std::cerr << "Compression::Trained needs a model, see setCompressionModel\n";
+                    return false;
+                }
+                codec.reset(new TrainedCodec(config.model));
+                break;
+            }
+
+            std::unique_ptr<PacketCompressor> compressor(new PacketCompressor(std::move(codec)));
+            if (!config.capturePath.empty())
+            {
+                compressor->capture.reset(new TrafficCapture());
+                if (!compressor->capture->open(config.capturePath))
+                {
+                    return false;
+                }
+            }
+            return install(h, std::move(compressor));
+        }
+
+        //codec may be null, which only captures (if set up) and never compresses.
+        static bool install(ENetHost* h, std::unique_ptr<PacketCompressor> context)
+        {
+            ENetCompressor compressor;
+            compressor.context = context.release();
+            compressor.compress = &PacketCompressor::enetCompress;
+            compressor.decompress = &PacketCompressor::enetDecompress;
+            compressor.destroy = &PacketCompressor::enetDestroy;
+            enet_host_compress(h, &compressor);
+            return true;
+        }
+
+        //Stats of the compressor installed on h, zeros if it has none of ours.
+        static CompressionStats statsOf(const ENetHost* h)
+        {
+            if (!h || h->compressor.compress != &PacketCompressor::enetCompress)
+            {
+                return CompressionStats();
+            }
+            return static_cast<const PacketCompressor*>(h->compressor.context)->stats;
+        }
+
+    private:
+        static uint64_t nowNs()
+        {
+            return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+        }
+
+        static size_t ENET_CALLBACK enetCompress(void* context, const ENetBuffer* in, size_t inCount, size_t inLimit, enet_uint8* out, size_t outLimit)
+        {
+            PacketCompressor& self = *static_cast<PacketCompressor*>(context);
+            ++self.stats.datagrams;
+
+            if (self.capture)
+            {
+                size_t n = PacketCodecAccess::gather(in, inCount, std::min<size_t>(inLimit, sizeof(self.captureScratch)), self.captureScratch);
+                self.capture->record(self.captureScratch, n);
+            }
+
+            if (!self.codec || inLimit < self.minSize || self.skipLeft)
+            {
+                if (self.skipLeft)
+                {
+                    --self.skipLeft;
+                }
+                ++self.stats.skipped;
+                return 0;
+            }
+
+            uint64_t start = nowNs();
+            size_t size = self.codec->compress(in, inCount, inLimit, out, outLimit);
+            self.stats.compressNs += nowNs() - start;
+
+            bool paid = size && size < inLimit;
+            self.stats.bytesIn += inLimit;
+            self.stats.bytesOut += paid ? size : inLimit;
+
+            if (paid)
+            {
+                ++self.stats.compressed;
+            }
+
+            //Less than 5% saved counts as a miss, enough misses in a row and we stop trying for a while.
+            if (paid && size * 20 < inLimit * 19)
+            {
+                self.misses = 0;
+            }
+            else if (++self.misses >= MissesBeforeBackoff)
+            {
+                self.misses = 0;
+                self.skipLeft = BackoffDatagrams;
+            }
+
+            return paid ? size : 0;
+        }
+
+        static size_t ENET_CALLBACK enetDecompress(void* context, const enet_uint8* in, size_t inLimit, enet_uint8* out, size_t outLimit)
+        {
+            PacketCompressor& self = *static_cast<PacketCompressor*>(context);
+            if (!self.codec)
+            {
+                return 0;
+            }
+
+            uint64_t start = nowNs();
+            size_t size = self.codec->decompress(in, inLimit, out, outLimit);
+            self.stats.decompressNs += nowNs() - start;
+            ++self.stats.decompressed;
+            return size;
+        }
+
+        static void ENET_CALLBACK enetDestroy(void* context)
+        {
+            delete static_cast<PacketCompressor*>(context);
+        }
+
+        //Borrows PacketCodec::gather for the capture.
+        struct PacketCodecAccess : PacketCodec
+        {
+            using PacketCodec::gather;
+        };
+
+        std::unique_ptr<PacketCodec> codec;
+        size_t minSize;
+        uint32_t misses;
+        uint32_t skipLeft;
+        CompressionStats stats;
+
+        std::unique_ptr<TrafficCapture> capture;
+        uint8_t captureScratch[ENET_PROTOCOL_MAXIMUM_MTU];
+    };
+
+    //Datagram checksums, set with NetServer/NetClient::setChecksum. Both ends must agree, ENet adds the
+    //checksum to every datagram header and drops datagrams that do not match.
+    enum class Checksum
+    {
+        None,   //Only the UDP checksum
+        Crc32c  //CRC-32C (Castagnoli), hardware accelerated where the CPU has SSE4.2
+    };
+
+    //CRC-32C with the SSE4.2 crc32 instruction when the CPU has it, and slicing-by-8 tables otherwise.
+    //The choice is made once, at first use.
+    class Crc32c
+    {
+    public:
+        //Continues crc over data. Start from 0, the pre and post inversion is done here.
+        static uint32_t update(uint32_t crc, const void* data, size_t size)
+        {
+            return ~impl()(~crc, static_cast<const uint8_t*>(data), size);
+        }
+
+        //ENetChecksumCallback. Runs across ENet's scatter buffers without copying them together.
+        static enet_uint32 ENET_CALLBACK enetChecksum(const ENetBuffer* buffers, size_t bufferCount)
+        {
+            Fn fn = impl();
+            uint32_t crc = 0xFFFFFFFFu;
+            for (size_t i = 0; i < bufferCount; ++i)
+            {
+                crc = fn(crc, static_cast<const uint8_t*>(buffers[i].data), buffers[i].dataLength);
+            }
+            return ~crc;
+        }
+
+        static bool hardwareAccelerated() { return impl() != &software; }
+
+        //Raw loops on an already inverted crc, public so benchmarks can compare them.
+        static uint32_t software(uint32_t crc, const uint8_t* p, size_t n)
+        {
+            const Tables& t = tables();
+
+            for (; n && (reinterpret_cast<uintptr_t>(p) & 7); --n)
+            {
+                crc = t.t[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+            }
+
+            for (; n >= 8; n -= 8, p += 8)
+            {
+                uint32_t lo, hi;
+                std::memcpy(&lo, p, 4);
+                std::memcpy(&hi, p + 4, 4);
+                lo ^= crc;
+                crc = t.t[7][lo & 0xFF] ^ t.t[6][(lo >> 8) & 0xFF] ^ t.t[5][(lo >> 16) & 0xFF] ^ t.t[4][lo >> 24]
+                    ^ t.t[3][hi & 0xFF] ^ t.t[2][(hi >> 8) & 0xFF] ^ t.t[1][(hi >> 16) & 0xFF] ^ t.t[0][hi >> 24];
+            }
+
+            for (; n; --n)
+            {
+                crc = t.t[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+            }
+            return crc;
+        }
+
+#ifdef SIMPLENET_X86
+#ifndef _MSC_VER
+        __attribute__((target("sse4.2")))
+#endif
+        static uint32_t hardware(uint32_t crc, const uint8_t* p, size_t n)
+        {
+            for (; n && (reinterpret_cast<uintptr_t>(p) & 7); --n)
+            {
+                crc = _mm_crc32_u8(crc, *p++);
+            }
+
+#if defined(_M_X64) || defined(__x86_64__)
+            uint64_t c = crc;
+            for (; n >= 8; n -= 8, p += 8)
+            {
+                uint64_t v;
+                std::memcpy(&v, p, 8);
+                c = _mm_crc32_u64(c, v);
+            }
+            crc = static_cast<uint32_t>(c);
+#endif
+            for (; n >= 4; n -= 4, p += 4)
+            {
+                uint32_t v;
+                std::memcpy(&v, p, 4);
+                crc = _mm_crc32_u32(crc, v);
+            }
+
+            for (; n; --n)
+            {
+                crc = _mm_crc32_u8(crc, *p++);
+            }
+            return crc;
+        }
+#endif
+
+    private:
+        using Fn = uint32_t (*)(uint32_t, const uint8_t*, size_t);
+
+        struct Tables
+        {
+            uint32_t t[8][256];
+
+            Tables()
+            {
+                for (uint32_t i = 0; i < 256; ++i)
+                {
+                    uint32_t c = i;
+                    for (int k = 0; k < 8; ++k)
+                    {
+                        c = (c >> 1) ^ (0x82F63B78u & (0u - (c & 1)));
+                    }
+                    t[0][i] = c;
+                }
+
+                for (uint32_t i = 0; i < 256; ++i)
+                {
+                    for (int k = 1; k < 8; ++k)
+                    {
+                        t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xFF];
+                    }
+                }
+            }
+        };
+
+        static const Tables& tables()
+        {
+            static const Tables instance;
+            return instance;
+        }
+
+        static bool cpuHasSse42()
+        {
+#ifdef SIMPLENET_X86
+#ifdef _MSC_VER
+            int info[4];
+            __cpuid(info, 1);
+            return (info[2] & (1 << 20)) != 0;
+#else
+            unsigned a, b, c, d;
+            return __get_cpuid(1, &a, &b, &c, &d) && (c & bit_SSE4_2);
+#endif
+#else
+            return false;
+#endif
+        }
+
+        static Fn impl()
+        {
+#ifdef SIMPLENET_X86
+            static const Fn chosen = cpuHasSse42() ? &hardware : &software;
+#else
+            static const Fn chosen = &software;
+#endif
+            return chosen;
+        }
+    };
+
+    //Bandwidth settings for a host. All rates are bytes per second, 0 means unlimited.
+    struct BandwidthLimits
+    {
+        uint32_t incoming = 0;     //Whole host, passed to enet_host_bandwidth_limit. Remotes are told to send no faster.
+        uint32_t outgoing = 0;     //Whole host, ENet shares it between peers
+        uint32_t perPeer = 0;      //Cap on what sendBudget hands out for one peer
+
+        //ENet's packet throttle, see enet_peer_throttle_configure. It drops unreliable packets when the
+        //round trip time climbs, and its current value also scales sendBudget.
+        uint32_t throttleIntervalMs = ENET_PEER_PACKET_THROTTLE_INTERVAL;
+        uint32_t throttleAcceleration = ENET_PEER_PACKET_THROTTLE_ACCELERATION;
+        uint32_t throttleDeceleration = ENET_PEER_PACKET_THROTTLE_DECELERATION;
+
+        void apply(ENetHost* h) const
+        {
+            enet_host_bandwidth_limit(h, incoming, outgoing);
+            for (ENetPeer* peer = h->peers; peer < &h->peers[h->peerCount]; ++peer)
+            {
+                if (peer->state == ENET_PEER_STATE_CONNECTED)
+                {
+                    apply(peer);
+                }
+            }
+        }
+
+        void apply(ENetPeer* peer) const
+        {
+            enet_peer_throttle_configure(peer, throttleIntervalMs, throttleAcceleration, throttleDeceleration);
+        }
+
+        //Bytes worth sending to peer in one tick of tickMs. The rate is the lowest of perPeer, an even share
+        //of outgoing and what the remote said it can take in, then scaled by the peer's packet throttle, which
+        //is ENet's measure of how congested the link currently is. Whatever is still queued for the peer
+        //comes off the top. UINT32_MAX when nothing limits it.
+        uint32_t budget(const ENetHost* h, ENetPeer* peer, uint32_t tickMs) const
+        {
+            uint64_t rate = perPeer;
+            auto limit = [&rate](uint64_t r)
+            {
+                if (r && (!rate || r < rate))
+                {
+                    rate = r;
+                }
+            };
+
+            limit(h->outgoingBandwidth / (h->connectedPeers ? h->connectedPeers : 1));
+            limit(peer->incomingBandwidth);
+
+            if (!rate)
+            {
+                return UINT32_MAX;
+            }
+
+            uint64_t bytes = rate * tickMs / 1000;
+            bytes = bytes * peer->packetThrottle / ENET_PEER_PACKET_THROTTLE_SCALE;
+
+            uint64_t queued = Backpressure::queuedBytes(peer);
+            bytes = bytes > queued ? bytes - queued : 0;
+            return static_cast<uint32_t>(std::min<uint64_t>(bytes, UINT32_MAX - 1));
+        }
+    };
+
+    //Refills at ratePerSec up to capacity, take() spends from it.
+    class TokenBucket
+    {
+    public:
+        using Clock = std::chrono::steady_clock;
+
+        TokenBucket() = default;
+        TokenBucket(double ratePerSec, double capacity) : rate(ratePerSec), cap(capacity), tokens(capacity), last(Clock::now()) {}
+
+        //Amounts over the capacity only need a full bucket, so one oversized message can still get through.
+        bool canTake(double amount, Clock::time_point now)
+        {
+            if (rate <= 0.0)
+            {
+                return true;
+            }
+            refill(now);
+            return tokens >= std::min(amount, cap);
+        }
+
+        void take(double amount)
+        {
+            if (rate > 0.0)
+            {
+                tokens -= std::min(amount, cap);
+            }
+        }
+
+    private:
+        void refill(Clock::time_point now)
+        {
+            tokens = std::min(cap, tokens + std::chrono::duration<double>(now - last).count() * rate);
+            last = now;
+        }
+
+        double rate = 0.0;
+        double cap = 0.0;
+        double tokens = 0.0;
+        Clock::time_point last;
+    };
+
+    //What NetServer does with a message from a peer that is over its inbound limits.
+    enum class RateLimitPolicy
+    {
+        Drop,       //Thrown away before the callback sees it
+        Delay,      //Held and handed to the callback once the peer is back under its limits
+        Disconnect  //Dropped, and the peer is disconnected
+    };
+
+    //Per-peer inbound limits for NetServer::setInboundLimits, checked before a message reaches the callback.
+    //0 turns a limit off. Bursts up to a second's worth are let through unless burst sizes are set.
+    struct InboundLimits
+    {
+        uint32_t messagesPerSec = 0;
+        uint32_t bytesPerSec = 0;
+        uint32_t burstMessages = 0;
+        uint32_t burstBytes = 0;
+        RateLimitPolicy policy = RateLimitPolicy::Drop;
+        uint32_t maxDelayed = 256;  //Messages held per peer with Delay, more than that are dropped
+
+        bool enabled() const { return messagesPerSec || bytesPerSec; }
+    };
+
+    struct RateLimitStats
+    {
+        uint64_t dropped = 0;
+        uint64_t droppedBytes = 0;
+        uint64_t delayed = 0;       //Held back at least once. They reach the callback later, unless the peer disconnects first, then they count as dropped
+        uint64_t disconnects = 0;
+    };
+
+    //Lock-free queue for many producer threads and one consumer (Vyukov's MPSC). A push is one atomic exchange
+    //and never waits. pop can briefly see the queue as empty while a push is half done, the item shows up on
+    //the next pop. Nodes come from NetAllocator, so every producer allocates out of its own thread cache (and
+    //they show up in Net::GetAllocatorStats, whatever the AllocatorPolicy).
+    template<typename T>
+    class MpscQueue
+    {
+    public:
+        MpscQueue() : head(makeNode()), tail(head.load(std::memory_order_relaxed)) {}
+        ~MpscQueue()
+        {
+            T discard;
+            while (pop(discard)) {}
+            freeNode(tail);
+        }
+
+        MpscQueue(const MpscQueue&) = delete;
+        MpscQueue& operator=(const MpscQueue&) = delete;
+
+        //Any thread. Only fails if memory runs out.
+        bool push(T&& value)
+        {
+            Node* node = makeNode();
+            if (!node)
+            {
+                return false;
+            }
+            node->value = std::move(value);
+
+            Node* prev = head.exchange(node, std::memory_order_acq_rel);
+            prev->next.store(node, std::memory_order_release);
+            return true;
+        }
+
+        //Consumer thread only.
+        bool pop(T& out)
+        {
+            Node* next = tail->next.load(std::memory_order_acquire);
+            if (!next)
+            {
+                return false;
+            }
+
+            out = std::move(next->value);
+            freeNode(tail);
+            tail = next;
+            return true;
+        }
+
+        //Consumer thread only.
+        bool empty() const { return tail->next.load(std::memory_order_acquire) == nullptr; }
+
+    private:
+        struct Node
+        {
+            std::atomic<Node*> next{ nullptr };
+            T value{};
+        };
+
+        static Node* makeNode()
+        {
+            void* memory = NetAllocator::allocate(sizeof(Node));
+            return memory ? new (memory) Node() : nullptr;
+        }
+
+        static void freeNode(Node* node)
+        {
+            node->~Node();
+            NetAllocator::release(node);
+        }
+
+        //Producers hammer head, the consumer owns tail. Kept on separate cache lines.
+        alignas(64) std::atomic<Node*> head;
+        alignas(64) Node* tail;
+    };
+
+    struct QueuedSendStats
+    {
+        uint64_t queued = 0;   //Pushed by producer threads
+        uint64_t sent = 0;     //Handed to ENet by the network thread
+        uint64_t failed = 0;   //Peer gone, over its high-water mark, or out of memory
+    };
+
+    //Sending for a NetServer from any thread, get it from NetServer::threadSafeSender() once the server is created.
+    //The calling thread builds the ENetPacket itself and pushes it onto a lock-free queue. The thread servicing
+    //the server hands everything to ENet at the start of service()/processReadable() and in flush(), right
+    //before ENet sends. So results only say whether the send was queued, problems show up in stats().
+    //A thread blocked in service(timeout) only gets to the queue when traffic arrives or the timeout runs
+    //out, so that timeout is how long a queued send can wait. Poll/epoll loops can also wait on
+    //NetServer::sendWakeHandle(), which turns readable as soon as something is queued.
+    class ThreadSafeSender
+    {
+    public:
+        ThreadSafeSender() = default;
+        ~ThreadSafeSender()
+        {
+            Command c;
+            while (commands.pop(c))
+            {
+                if (c.packet)
+                {
+                    enet_packet_destroy(c.packet);
+                }
+            }
+
+            if (wakeSocket != ENET_SOCKET_NULL)
+            {
+                enet_socket_destroy(wakeSocket);
+            }
+        }
+
+        ThreadSafeSender(const ThreadSafeSender&) = delete;
+        ThreadSafeSender& operator=(const ThreadSafeSender&) = delete;
+
+        SendResult sendTo(uint32_t peerId, const Packet& p, PacketReliability r = PacketReliability::Reliable, int channel = 0)
+        {
+            if (!channels.valid(channel))
+            {
+                return SendResult::Failed;
+            }
+            return queue(Command::Send, peerId, p, static_cast<uint8_t>(channel), channels.flags(static_cast<uint8_t>(channel), r));
+        }
+
+        //Sends with the delivery mode the channel was declared with.
+        template<typename Channel, EnableIfChannel<Channel> = 0>
+        SendResult sendTo(uint32_t peerId, const Packet& p, Channel channel)
+        {
+            if (!channels.valid(static_cast<int>(channel)))
+            {
+                return SendResult::Failed;
+            }
+            uint8_t id = static_cast<uint8_t>(channel);
+            return queue(Command::Send, peerId, p, id, channels.flags(id));
+        }
+
+        void broadcast(const Packet& p, PacketReliability r = PacketReliability::Reliable, int channel = 0)
+        {
+            if (channels.valid(channel))
+            {
+                queue(Command::Broadcast, 0, p, static_cast<uint8_t>(channel), channels.flags(static_cast<uint8_t>(channel), r));
+            }
+        }
+
+        template<typename Channel, EnableIfChannel<Channel> = 0>
+        void broadcast(const Packet& p, Channel channel)
+        {
+            if (channels.valid(static_cast<int>(channel)))
+            {
+                uint8_t id = static_cast<uint8_t>(channel);
+                queue(Command::Broadcast, 0, p, id, channels.flags(id));
+            }
+        }
+
+        void disconnect(uint32_t peerId, uint32_t data = 0)
+        {
+            Command c;
+            c.kind = Command::Disconnect;
+            c.peerId = peerId;
+            c.data = data;
+            if (commands.push(std::move(c)))
+            {
+                queuedCount.fetch_add(1, std::memory_order_relaxed);
+                signal();
+            }
+        }
+
+        QueuedSendStats stats() const
+        {
+            QueuedSendStats s;
+            s.queued = queuedCount.load(std::memory_order_relaxed);
+            s.sent = sentCount.load(std::memory_order_relaxed);
+            s.failed = failedCount.load(std::memory_order_relaxed);
+            return s;
+        }
+
+    private:
+        friend class NetServer;
+
+        struct Command
+        {
+            enum Kind { Send, Broadcast, Disconnect } kind = Send;
+            uint32_t peerId = 0;
+            uint8_t channel = 0;
+            uint32_t data = 0;               //Disconnect only
+            ENetPacket* packet = nullptr;    //Owned until the network thread hands it to ENet
+        };
+
+        SendResult queue(Command::Kind kind, uint32_t peerId, const Packet& p, uint8_t channel, enet_uint32 flags)
+        {
+            Command c;
+            c.kind = kind;
+            c.peerId = peerId;
+            c.channel = channel;
+            c.packet = enet_packet_create(p.data.data(), p.data.size(), flags);
+            if (!c.packet)
+            {
+                failedCount.fetch_add(1, std::memory_order_relaxed);
+                return SendResult::Failed;
+            }
+
+            ENetPacket* packet = c.packet;
+            if (!commands.push(std::move(c)))
+            {
+                enet_packet_destroy(packet);
+                failedCount.fetch_add(1, std::memory_order_relaxed);
+                return SendResult::Failed;
+            }
+            queuedCount.fetch_add(1, std::memory_order_relaxed);
+            signal();
+            return SendResult::Ok;
+        }
+
+        //A UDP socket on loopback that sends to itself, so it works in select/poll/epoll everywhere.
+        bool openWake()
+        {
+            if (wakeSocket != ENET_SOCKET_NULL)
+            {
+                return true;
+            }
+
+            ENetSocket socket = enet_socket_create(ENET_SOCKET_TYPE_DATAGRAM);
+            if (socket == ENET_SOCKET_NULL)
+            {
+                std::cerr << "Failed to create send wakeup socket\n";
+                return false;
+            }
+
+            ENetAddress address;
+            enet_address_set_host_ip(&address, "127.0.0.1");
+            address.port = 0;
+            if (enet_socket_bind(socket, &address) < 0 || enet_socket_get_address(socket, &wakeAddress) < 0)
+            {
+                std::cerr << "Failed to bind send wakeup socket\n";
+                enet_socket_destroy(socket);
+                return false;
+            }
+            wakeAddress.host = address.host;
+            enet_socket_set_option(socket, ENET_SOCKOPT_NONBLOCK, 1);
+
+            wakeSocket = socket;
+            return true;
+        }
+
+        //One datagram per wakeup, not per push: producers only send when the consumer has cleared the flag.
+        void signal()
+        {
+            if (wakeSocket == ENET_SOCKET_NULL || woken.exchange(true, std::memory_order_acq_rel))
+            {
+                return;
+            }
+
+            uint8_t byte = 0;
+            ENetBuffer buffer;
+            buffer.data = &byte;
+            buffer.dataLength = 1;
+            enet_socket_send(wakeSocket, &wakeAddress, &buffer, 1);
+        }
+
+        //Network thread, before popping. Draining before the flag is cleared means a wakeup sent after
+        //this stays in the socket, the worst case is one spurious wakeup.
+        void clearWake()
+        {
+            if (wakeSocket == ENET_SOCKET_NULL || !woken.load(std::memory_order_acquire))
+            {
+                return;
+            }
+
+            uint8_t byte = 0;
+            ENetBuffer buffer;
+            buffer.data = &byte;
+            buffer.dataLength = 1;
+            ENetAddress from;
+            while (enet_socket_receive(wakeSocket, &from, &buffer, 1) > 0) {}
+
+            woken.store(false, std::memory_order_release);
+        }
+
+        ChannelLayout channels = ChannelLayout::Default();  //Set by NetServer::create, before any producer runs
+        MpscQueue<Command> commands;
+        std::atomic<uint64_t> queuedCount{ 0 };
+        std::atomic<uint64_t> sentCount{ 0 };
+        std::atomic<uint64_t> failedCount{ 0 };
+
+        ENetSocket wakeSocket = ENET_SOCKET_NULL;  //Opened before any producer runs, see openWake
+        ENetAddress wakeAddress = { 0, 0 };
+        std::atomic<bool> woken{ false };
+    };
+
+    class NetServer 
+    {
+    public:
+        using EventCallback = std::function<void(const NetEvent&)>;
+
+        //Peer ids run 1..MaxPeerId and then wrap, skipping ids still connected. ShardedServer keeps its shard
+        //number in the bits above.
+        static constexpr uint32_t MaxPeerId = (1u << 24) - 1;
+
+        NetServer() : host(nullptr), nextPeerId(1), discoverySocket(ENET_SOCKET_NULL) {}
+        ~NetServer() 
+        {
+            disableDiscovery();
+
+            if (host) 
+            {
+                enet_host_destroy(host);
+                host = nullptr;
+            }
+        }
+
+        //Clients get at most layout.count() channels, fewer if they ask for fewer.
+        bool create(uint16_t port, uint32_t maxClients = 32, const ChannelLayout& layout = ChannelLayout::Default()) 
+        {
+            ENetAddress address;
+            address.host = ENET_HOST_ANY;
+            address.port = port;
+            channels = layout;
+            counters.reset(channels.count());
+            queuedSends.channels = layout;
+
+            //ENet binds inside enet_host_create, before SO_REUSEPORT could be set, so a shared port starts
+            //unbound and gets its socket swapped in.
+            host = enet_host_create(reusePort ? NULL : &address, maxClients, channels.count(), bandwidth.incoming, bandwidth.outgoing);
+            if (host && reusePort && !bindShared(address))
+            {
+                enet_host_destroy(host);
+                host = nullptr;
+            }
+            HostBatching::enable(host);
+
+            if (!host) 
+            {
+                std::cerr << "Failed to create ENet server host on port " << port << "\n";
+                return false;
+            }
+
+            if (!PacketCompressor::install(host, compression))
+            {
+                std::cerr << "Failed to set up compression, sending uncompressed\n";
+            }
+            setChecksum(checksum);
+
+            info.port = port;
+            info.maxPlayers = static_cast<uint16_t>(maxClients);
+            return true;
+        }
+
+        //Answers LAN discovery probes on discoveryPort with this server's ServerInfo.
+        //Several servers on one machine can share the discovery port.
+        bool enableDiscovery(uint16_t discoveryPort = DiscoveryProtocol::DefaultPort)
+        {
+            disableDiscovery();
+
+            discoverySocket = enet_socket_create(ENET_SOCKET_TYPE_DATAGRAM);
+            if (discoverySocket == ENET_SOCKET_NULL)
+            {
+                std::cerr << "Failed to create discovery socket\n";
+                return false;
+            }
+
+            enet_socket_set_option(discoverySocket, ENET_SOCKOPT_REUSEADDR, 1);
+            enet_socket_set_option(discoverySocket, ENET_SOCKOPT_BROADCAST, 1);
+            enet_socket_set_option(discoverySocket, ENET_SOCKOPT_NONBLOCK, 1);
+
+            ENetAddress address;
+            address.host = ENET_HOST_ANY;
+            address.port = discoveryPort;
+            if (enet_socket_bind(discoverySocket, &address) < 0)
+            {
+                std::cerr << "Failed to bind discovery port " << discoveryPort << "\n";
+                disableDiscovery();
+                return false;
+            }
+
+            answerPings();
+            return true;
+        }
+
+        //Answers ServerBrowser pings on the game port. enableDiscovery turns this on too, this is for servers
+        //that share a port and leave the discovery socket to one of them.
+        void answerPings()
+        {
+            if (host)
+            {
+                pingRegistry().add(host, this);
+                host->intercept = &NetServer::interceptPing;
+            }
+        }
+
+        //Where discovery replies get the player count from. Defaults to this server's connections.
+        void setPlayerCounter(std::function<uint16_t()> counter) { playerCounter = std::move(counter); }
+
+        //Lets several servers in one process (or several processes) bind the same port, the kernel spreads
+        //clients across them by address. Linux only. Set it before create().
+        bool setReusePort(bool enable)
+        {
+#ifdef __linux__
+            reusePort = enable;
+            return true;
+#else
+            reusePort = false;
+            return !enable;
+#endif
+        }
+
+        void disableDiscovery()
+        {
+            if (discoverySocket != ENET_SOCKET_NULL)
+            {
+                enet_socket_destroy(discoverySocket);
+                discoverySocket = ENET_SOCKET_NULL;
+            }
+
+            if (host && host->intercept == &NetServer::interceptPing)
+            {
+                host->intercept = nullptr;
+                pingRegistry().remove(host);
+            }
+        }
+
+        //Tick rate and load (0-255) advertised to discovery. Player count is filled in automatically.
+        void setServerInfo(uint16_t tickRate, uint8_t load)
+        {
+            info.tickRate = tickRate;
+            info.load = load;
+        }
+
+        void service(uint32_t timeoutMs, const EventCallback& cb) 
+        {
+            ServiceOptions options;
+            options.timeoutMs = timeoutMs;
+            service(options, cb);
+        }
+
+        //Same as above, but stops handing out events at options.maxEvents or after options.budgetUs.
+        //The rest stay queued for the next call, serviceStats() counts them.
+        void service(const ServiceOptions& options, const EventCallback& cb)
+        {
+            if (!host)
+            {
+                return;
+            }
+
+            sendQueued();
+            answerDiscovery();
+            releaseDelayed(cb);
+            ServiceOptions::drain(host, options, serviceCounters, [&](const ENetEvent& event) { dispatch(event, cb); });
+            reportWritable(cb);
+        }
+
+        const ServiceStats& serviceStats() const { return serviceCounters; }
+
+        //For running the server from your own poll/epoll loop instead of service(timeout): wait until
+        //socketHandle() (or discoverySocketHandle(), when discovery is on) is readable or nextTimeoutMs()
+        //runs out, then call processReadable(). Nothing in here blocks.
+        ENetSocket socketHandle() const { return host ? host->socket : ENET_SOCKET_NULL; }
+        ENetSocket discoverySocketHandle() const { return discoverySocket; }
+
+        //Readable once another thread queues something through threadSafeSender(), so a poll loop can wait
+        //on it next to socketHandle() and hand those sends over without waiting out nextTimeoutMs().
+        //Off until enableSendWakeup(), which has to be called before other threads start sending.
+        bool enableSendWakeup() { return queuedSends.openWake(); }
+        ENetSocket sendWakeHandle() const { return queuedSends.wakeSocket; }
+
+        uint32_t nextTimeoutMs(uint32_t maxMs = 1000) const
+        {
+            if (!host)
+            {
+                return maxMs;
+            }
+
+            //Other threads queued sends, they go out on the next call.
+            if (!queuedSends.commands.empty())
+            {
+                return 0;
+            }
+
+            uint32_t wait = ServiceOptions::nextTimeoutMs(host, maxMs);
+            for (const auto& kv : limiters)
+            {
+                //Held messages are released as tokens come back, roughly one message interval from now.
+                if (!kv.second.delayed.empty())
+                {
+                    wait = std::min<uint32_t>(wait, std::max<uint32_t>(1, 1000 / std::max<uint32_t>(1, inboundLimits.messagesPerSec)));
+                    break;
+                }
+            }
+            return wait;
+        }
+
+        //Non-blocking receive, send and dispatch. Same as service() with a zero timeout.
+        void processReadable(const EventCallback& cb, const ServiceOptions& limits = ServiceOptions())
+        {
+            ServiceOptions options = limits;
+            options.timeoutMs = 0;
+            service(options, cb);
+        }
+
+        SendResult sendTo(uint32_t peerId, const Packet& p, PacketReliability r = PacketReliability::Reliable, int channel = 0) 
+        {
+            if (!checkChannel(channel))
+            {
+                return SendResult::Failed;
+            }
+            return sendOn(peerId, p, static_cast<uint8_t>(channel), channels.flags(static_cast<uint8_t>(channel), r));
+        }
+
+        //Sends with the delivery mode the channel was declared with.
+        template<typename Channel, EnableIfChannel<Channel> = 0>
+        SendResult sendTo(uint32_t peerId, const Packet& p, Channel channel)
+        {
+            if (!checkChannel(static_cast<int>(channel)))
+            {
+                return SendResult::Failed;
+            }
+            uint8_t id = static_cast<uint8_t>(channel);
+            return sendOn(peerId, p, id, channels.flags(id));
+        }
+
+        void broadcast(const Packet& p, PacketReliability r = PacketReliability::Reliable, int channel = 0) 
+        {
+            if (!checkChannel(channel))
+            {
+                return;
+            }
+            broadcastOn(p, static_cast<uint8_t>(channel), channels.flags(static_cast<uint8_t>(channel), r));
+        }
+
+        template<typename Channel, EnableIfChannel<Channel> = 0>
+        void broadcast(const Packet& p, Channel channel)
+        {
+            if (!checkChannel(static_cast<int>(channel)))
+            {
+                return;
+            }
+            uint8_t id = static_cast<uint8_t>(channel);
+            broadcastOn(p, id, channels.flags(id));
+        }
+
+        const ChannelLayout& channelLayout() const { return channels; }
+
+        //Applies bandwidth limits and throttle settings now and to every peer that connects later.
+        void setBandwidthLimits(const BandwidthLimits& limits)
+        {
+            bandwidth = limits;
+            if (host)
+            {
+                bandwidth.apply(host);
+            }
+        }
+
+        //Compresses datagrams with mode, now or when the host is created. Clients must use the same mode.
+        bool setCompression(Compression mode)
+        {
+            compression.mode = mode;
+            return !host || PacketCompressor::install(host, compression);
+        }
+
+        //Switches to Compression::Trained with model, e.g. TrainedModel::load("game.model"). Both ends need the same model.
+        bool setCompressionModel(std::shared_ptr<const TrainedModel> model)
+        {
+            compression.mode = Compression::Trained;
+            compression.model = std::move(model);
+            return !host || PacketCompressor::install(host, compression);
+        }
+
+        //Records every outgoing datagram to path for Tools/TrafficTrainer. Empty path stops recording.
+        bool captureTraffic(const std::string& path)
+        {
+            compression.capturePath = path;
+            return !host || PacketCompressor::install(host, compression);
+        }
+
+        //Checksums every datagram, must match the other end. Set it before connections are made.
+        void setChecksum(Checksum mode)
+        {
+            checksum = mode;
+            if (host)
+            {
+                host->checksum = mode == Checksum::Crc32c ? &Crc32c::enetChecksum : NULL;
+            }
+        }
+
+        //Coalesced lets several sends in one tick share a datagram, they go out on the next service() or flush().
+        void setFlushPolicy(FlushPolicy policy) { flushPolicy = policy; }
+
+        //Hands everything queued to the socket now, including what other threads queued through threadSafeSender().
+        void flush()
+        {
+            if (host)
+            {
+                sendQueued();
+                HostBatching::flush(host);
+            }
+        }
+
+        //For sending from threads other than the one servicing the server.
+        ThreadSafeSender& threadSafeSender() { return queuedSends; }
+        QueuedSendStats queuedSendStats() const { return queuedSends.stats(); }
+
+        IoStats ioStats() const { return IoStats::of(host); }
+
+        CompressionStats compressionStats() const { return PacketCompressor::statsOf(host); }
+
+        using BackpressureCallback = std::function<void(uint32_t peerId, size_t queuedBytes)>;
+
+        //Limits how much each peer may send, see InboundLimits. Applies to peers that connect from now on.
+        void setInboundLimits(const InboundLimits& limits)
+        {
+            inboundLimits = limits;
+        }
+
+        //Totals over all peers.
+        const RateLimitStats& rateLimitStats() const { return rateLimitTotals; }
+
+        //False if peerId has no limiter (not connected, or limits were off when it connected).
+        bool rateLimitStats(uint32_t peerId, RateLimitStats& out) const
+        {
+            auto it = limiters.find(peerId);
+            if (it == limiters.end())
+            {
+                return false;
+            }
+            out = it->second.stats;
+            return true;
+        }
+
+        //Once a peer has highWater bytes queued (see Backpressure::queuedBytes), sendTo returns WouldBlock
+        //and broadcasts skip it. onBlocked is called when that starts. After the queue drains to lowWater,
+        //service() reports a Writable event for the peer. highWater 0 turns it off again.
+        void setBackpressure(size_t highWater, size_t lowWater, BackpressureCallback onBlocked = nullptr)
+        {
+            backpressure.highWater = highWater;
+            backpressure.lowWater = std::min(lowWater, highWater);
+            onBackpressure = std::move(onBlocked);
+            if (!highWater)
+            {
+                blockedPeers.clear();
+            }
+        }
+
+        size_t queuedBytes(uint32_t peerId) const
+        {
+            auto it = idMap.find(peerId);
+            return it != idMap.end() ? Backpressure::queuedBytes(it->second) : 0;
+        }
+
+        bool isBlocked(uint32_t peerId) const
+        {
+            return std::find(blockedPeers.begin(), blockedPeers.end(), peerId) != blockedPeers.end();
+        }
+
+        //How many bytes to send peerId this tick, see BandwidthLimits::budget. 0 for unknown peers.
+        //Feed it to StateSender::flush (or a PriorityAccumulator) so only what fits goes out and the rest waits.
+        uint32_t sendBudget(uint32_t peerId, uint32_t tickMs) const
+        {
+            auto it = idMap.find(peerId);
+            return it != idMap.end() ? bandwidth.budget(host, it->second, tickMs) : 0;
+        }
+
+        //Smallest budget over all peers, for data that is broadcast.
+        uint32_t broadcastBudget(uint32_t tickMs) const
+        {
+            uint32_t smallest = UINT32_MAX;
+            for (const auto& kv : idMap)
+            {
+                smallest = std::min(smallest, bandwidth.budget(host, kv.second, tickMs));
+            }
+            return smallest;
+        }
+
+        //Totals over all peers. Broadcasts count once per peer they went to.
+        ChannelStats channelStats(uint8_t channel) const { return counters.get(channel); }
+
+        template<typename Channel, EnableIfChannel<Channel> = 0>
+        ChannelStats channelStats(Channel channel) const { return counters.get(static_cast<uint8_t>(channel)); }
+
+        //False if peerId is not connected.
+        bool peerStats(uint32_t peerId, PeerStats& out) const
+        {
+            auto it = idMap.find(peerId);
+            if (it == idMap.end())
+            {
+                return false;
+            }
+            out = PeerStats::of(it->second);
+            return true;
+        }
+
+        void disconnect(uint32_t peerId, uint32_t data = 0) 
+        {
+            auto it = idMap.find(peerId);
+            if (it == idMap.end())
+            {
+                return;
+            }
+
+            enet_peer_disconnect(it->second, data);
+        }
+
+        size_t connectedCount() const { return peerMap.size(); }
+
+    private:
+        bool checkChannel(int channel) const
+        {
+            if (!channels.valid(channel))
+            {
+                std::cerr << "Channel " << channel << " is not in this server's layout (" << channels.count() << " channels)\n";
+                return false;
+            }
+            return true;
+        }
+
+        SendResult sendOn(uint32_t peerId, const Packet& p, uint8_t channel, enet_uint32 flags)
+        {
+            if (!idMap.count(peerId))
+            {
+                return SendResult::NoPeer;
+            }
+
+            ENetPacket* packet = enet_packet_create(p.data.data(), p.data.size(), flags);
+            if (!packet)
+            {
+                return SendResult::Failed;
+            }
+
+            SendResult result = sendPacket(peerId, packet, channel);
+            if (result == SendResult::Ok && flushPolicy == FlushPolicy::Immediate)
+            {
+                HostBatching::flush(host);
+            }
+            return result;
+        }
+
+        void broadcastOn(const Packet& p, uint8_t channel, enet_uint32 flags)
+        {
+            if (!host)
+            {
+                return;
+            }
+
+            ENetPacket* packet = enet_packet_create(p.data.data(), p.data.size(), flags);
+            if (!packet)
+            {
+                return;
+            }
+
+            broadcastPacket(packet, channel);
+            if (flushPolicy == FlushPolicy::Immediate)
+            {
+                HostBatching::flush(host);
+            }
+        }
+
+        //Takes the packet, destroys it if it can't be sent.
+        SendResult sendPacket(uint32_t peerId, ENetPacket* packet, uint8_t channel)
+        {
+            auto it = idMap.find(peerId);
+            if (it == idMap.end())
+            {
+                enet_packet_destroy(packet);
+                return SendResult::NoPeer;
+            }
+
+            ENetPeer* peer = it->second;
+            if (overHighWater(peerId, peer))
+            {
+                enet_packet_destroy(packet);
+                return SendResult::WouldBlock;
+            }
+
+            size_t size = packet->dataLength;
+            if (enet_peer_send(peer, channel, packet) < 0)
+            {
+                //Peer negotiated fewer channels than the layout has.
+                enet_packet_destroy(packet);
+                return SendResult::Failed;
+            }
+            counters.sent(channel, size);
+            return SendResult::Ok;
+        }
+
+        void broadcastPacket(ENetPacket* packet, uint8_t channel)
+        {
+            size_t size = packet->dataLength;
+            if (!backpressure.highWater)
+            {
+                counters.sent(channel, size, peerMap.size());
+                enet_host_broadcast(host, channel, packet);
+                return;
+            }
+
+            //Same as enet_host_broadcast, minus the peers that are over the high-water mark.
+            for (const auto& kv : idMap)
+            {
+                if (!overHighWater(kv.first, kv.second) && enet_peer_send(kv.second, channel, packet) == 0)
+                {
+                    counters.sent(channel, size);
+                }
+            }
+
+            if (packet->referenceCount == 0)
+            {
+                enet_packet_destroy(packet);
+            }
+        }
+
+        //Hands what other threads queued through threadSafeSender() to ENet. No flush, ENet sends it next.
+        void sendQueued()
+        {
+            queuedSends.clearWake();
+
+            ThreadSafeSender::Command c;
+            while (queuedSends.commands.pop(c))
+            {
+                bool ok = true;
+                switch (c.kind)
+                {
+                case ThreadSafeSender::Command::Send:
+                {
+                    ok = sendPacket(c.peerId, c.packet, c.channel) == SendResult::Ok;
+                    break;
+                }
+                case ThreadSafeSender::Command::Broadcast:
+                {
+                    broadcastPacket(c.packet, c.channel);
+                    break;
+                }
+                case ThreadSafeSender::Command::Disconnect:
+                {
+                    ok = idMap.count(c.peerId) != 0;
+                    disconnect(c.peerId, c.data);
+                    break;
+                }
+                }
+                (ok ? queuedSends.sentCount : queuedSends.failedCount).fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+
+        //True if peer is (or just went) over the high-water mark.
+        bool overHighWater(uint32_t peerId, ENetPeer* peer)
+        {
+            if (!backpressure.highWater)
+            {
+                return false;
+            }
+
+            if (isBlocked(peerId))
+            {
+                return true;
+            }
+
+            size_t queued = Backpressure::queuedBytes(peer);
+            if (queued < backpressure.highWater)
+            {
+                return false;
+            }
+
+            blockedPeers.push_back(peerId);
+            if (onBackpressure)
+            {
+                onBackpressure(peerId, queued);
+            }
+            return true;
+        }
+
+        //Unblocks peers whose queue has drained to the low-water mark.
+        void reportWritable(const EventCallback& cb)
+        {
+            for (size_t i = 0; i < blockedPeers.size();)
+            {
+                uint32_t id = blockedPeers[i];
+                auto it = idMap.find(id);
+                if (it != idMap.end() && Backpressure::queuedBytes(it->second) > backpressure.lowWater)
+                {
+                    ++i;
+                    continue;
+                }
+
+                blockedPeers.erase(blockedPeers.begin() + i);
+                if (it == idMap.end())
+                {
+                    continue;
+                }
+
+                NetEvent e;
+                e.type = NetEvent::Writable;
+                e.peerId = id;
+                cb(e);
+            }
+        }
+
+        //Token buckets and held messages for one peer.
+        struct PeerLimiter
+        {
+            TokenBucket messages;
+            TokenBucket bytes;
+            std::deque<NetEvent> delayed;
+            RateLimitStats stats;
+            bool disconnecting = false;
+        };
+
+        enum class Admission { Deliver, Hold, Reject };
+
+        //Checks a size byte message from id against its limits and counts it. Hold means it goes on the
+        //peer's delayed queue, Reject means it is thrown away (and the peer may be getting disconnected).
+        Admission admit(uint32_t id, size_t size)
+        {
+            auto it = limiters.find(id);
+            if (it == limiters.end())
+            {
+                return Admission::Deliver;
+            }
+
+            PeerLimiter& limiter = it->second;
+            TokenBucket::Clock::time_point now = TokenBucket::Clock::now();
+
+            //Anything arriving behind held messages waits its turn so order is kept.
+            if (!limiter.disconnecting && limiter.delayed.empty() && limiter.messages.canTake(1, now) && limiter.bytes.canTake(static_cast<double>(size), now))
+            {
+                limiter.messages.take(1);
+                limiter.bytes.take(static_cast<double>(size));
+                return Admission::Deliver;
+            }
+
+            if (!limiter.disconnecting && inboundLimits.policy == RateLimitPolicy::Delay && limiter.delayed.size() < inboundLimits.maxDelayed)
+            {
+                ++limiter.stats.delayed;
+                ++rateLimitTotals.delayed;
+                return Admission::Hold;
+            }
+
+            ++limiter.stats.dropped;
+            limiter.stats.droppedBytes += size;
+            ++rateLimitTotals.dropped;
+            rateLimitTotals.droppedBytes += size;
+
+            if (inboundLimits.policy == RateLimitPolicy::Disconnect && !limiter.disconnecting)
+            {
+                limiter.disconnecting = true;
+                ++limiter.stats.disconnects;
+                ++rateLimitTotals.disconnects;
+                std::cerr << "Peer " << id << " went over its inbound limits, disconnecting\n";
+                disconnect(id);
+            }
+            return Admission::Reject;
+        }
+
+        //Hands held messages to the callback as the peers' buckets refill.
+        void releaseDelayed(const EventCallback& cb)
+        {
+            TokenBucket::Clock::time_point now = TokenBucket::Clock::now();
+            for (auto& kv : limiters)
+            {
+                PeerLimiter& limiter = kv.second;
+                while (!limiter.delayed.empty())
+                {
+                    double size = static_cast<double>(limiter.delayed.front().packet.data.size());
+                    if (!limiter.messages.canTake(1, now) || !limiter.bytes.canTake(size, now))
+                    {
+                        break;
+                    }
+                    limiter.messages.take(1);
+                    limiter.bytes.take(size);
+
+                    NetEvent e = std::move(limiter.delayed.front());
+                    limiter.delayed.pop_front();
+                    cb(e);
+                }
+            }
+        }
+
+        //ENet caps a host at 4095 peers, so a free id always turns up.
+        uint32_t allocatePeerId()
+        {
+            for (;;)
+            {
+                uint32_t id = nextPeerId;
+                nextPeerId = nextPeerId == MaxPeerId ? 1 : nextPeerId + 1;
+                if (!idMap.count(id))
+                {
+                    return id;
+                }
+            }
+        }
+
+        void dispatch(const ENetEvent& event, const EventCallback& cb)
+        {
+            switch (event.type) 
+            {
+            case ENET_EVENT_TYPE_CONNECT: 
+            {
+                uint32_t id = allocatePeerId();
+                peerMap[event.peer] = id;
+                idMap[id] = event.peer;
+                event.peer->data = reinterpret_cast<void*>(static_cast<uintptr_t>(id));
+                bandwidth.apply(event.peer);
+
+                if (inboundLimits.enabled())
+                {
+                    PeerLimiter& limiter = limiters[id];
+                    limiter.messages = TokenBucket(inboundLimits.messagesPerSec, inboundLimits.burstMessages ? inboundLimits.burstMessages : inboundLimits.messagesPerSec);
+                    limiter.bytes = TokenBucket(inboundLimits.bytesPerSec, inboundLimits.burstBytes ? inboundLimits.burstBytes : inboundLimits.bytesPerSec);
+                }
+                NetEvent e;
+                e.type = NetEvent::Connect;
+                e.peerId = id;
+                cb(e);
+                break;
+            }
+            case ENET_EVENT_TYPE_DISCONNECT: 
+            {
+                auto it = peerMap.find(event.peer);
+                uint32_t id = 0;
+
+                if (it != peerMap.end()) 
+                {
+                    id = it->second;
+                    peerMap.erase(it);
+                    idMap.erase(id);
+                }
+
+                //Held messages go with the peer, they would only arrive after its Disconnect.
+                auto limiter = limiters.find(id);
+                if (limiter != limiters.end())
+                {
+                    for (const NetEvent& held : limiter->second.delayed)
+                    {
+                        ++rateLimitTotals.dropped;
+                        rateLimitTotals.droppedBytes += held.packet.data.size();
+                    }
+                    limiters.erase(limiter);
+                }
+
+                NetEvent e;
+                e.type = NetEvent::Disconnect;
+                e.peerId = id;
+                cb(e);
+                break;
+            }
+            case ENET_EVENT_TYPE_RECEIVE: {
+                auto it = peerMap.find(event.peer);
+                uint32_t id = (it != peerMap.end()) ? it->second : 0;
+                counters.received(event.channelID, event.packet->dataLength);
+
+                //Checked before copying anything, so a flood that gets dropped costs as little as possible.
+                Admission verdict = admit(id, event.packet->dataLength);
+                if (verdict != Admission::Reject)
+                {
+                    NetEvent e;
+                    e.type = NetEvent::Receive;
+                    e.peerId = id;
+                    e.channel = event.channelID;
+                    e.packet.data.resize(event.packet->dataLength);
+                    std::memcpy(e.packet.data.data(), event.packet->data, event.packet->dataLength);
+
+                    if (verdict == Admission::Deliver)
+                    {
+                        cb(e);
+                    }
+                    else
+                    {
+                        limiters[id].delayed.push_back(std::move(e));
+                    }
+                }
+                enet_packet_destroy(event.packet);
+                break;
+            }
+            default: break;
+            }
+        }
+
+        //Maps ENet hosts back to their NetServer for the intercept callback, which only gets the host.
+        class PingRegistry
+        {
+        public:
+            void add(ENetHost* h, NetServer* s)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                servers[h] = s;
+            }
+
+            void remove(ENetHost* h)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                servers.erase(h);
+            }
+
+            NetServer* find(ENetHost* h)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                auto it = servers.find(h);
+                return it != servers.end() ? it->second : nullptr;
+            }
+
+        private:
+            std::mutex mutex;
+            std::unordered_map<ENetHost*, NetServer*> servers;
+        };
+
+        static PingRegistry& pingRegistry()
+        {
+            static PingRegistry registry;
+            return registry;
+        }
+
+        //Called by ENet for every datagram on the game socket. Answers ServerBrowser pings and lets
+        //everything else through. The magic check keeps the common path to a few compares.
+        static int ENET_CALLBACK interceptPing(ENetHost* h, ENetEvent*)
+        {
+            if (h->receivedDataLength < 10)
+            {
+                return 0;
+            }
+
+            uint32_t magic = 0;
+            std::memcpy(&magic, h->receivedData, sizeof(magic));
+            if (magic != DiscoveryProtocol::Magic)
+            {
+                return 0;
+            }
+
+            PacketReader r(h->receivedData, h->receivedDataLength);
+            uint8_t type = 0;
+            uint32_t nonce = 0;
+            if (!DiscoveryProtocol::readHeader(r, type, nonce) || type != DiscoveryProtocol::Ping)
+            {
+                return 0;
+            }
+
+            NetServer* server = pingRegistry().find(h);
+            if (server)
+            {
+                server->info.playerCount = server->playerCount();
+                DiscoveryProtocol::sendTo(h->socket, h->receivedAddress, DiscoveryProtocol::makeReply(nonce, server->info, DiscoveryProtocol::Pong));
+            }
+            return 1;
+        }
+
+        uint16_t playerCount() const
+        {
+            return playerCounter ? playerCounter() : static_cast<uint16_t>(peerMap.size());
+        }
+
+        //Replaces the unbound socket enet_host_create made with one bound to address with SO_REUSEPORT.
+        //Same socket options ENet uses for its own.
+        bool bindShared(const ENetAddress& address)
+        {
+#ifdef __linux__
+            ENetSocket socket = enet_socket_create(ENET_SOCKET_TYPE_DATAGRAM);
+            if (socket == ENET_SOCKET_NULL)
+            {
+                return false;
+            }
+
+            int on = 1;
+            if (setsockopt(socket, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0 || enet_socket_bind(socket, &address) < 0)
+            {
+                std::cerr << "Failed to bind shared port " << address.port << "\n";
+                enet_socket_destroy(socket);
+                return false;
+            }
+            enet_socket_set_option(socket, ENET_SOCKOPT_NONBLOCK, 1);
+            enet_socket_set_option(socket, ENET_SOCKOPT_BROADCAST, 1);
+            enet_socket_set_option(socket, ENET_SOCKOPT_RCVBUF, ENET_HOST_RECEIVE_BUFFER_SIZE);
+            enet_socket_set_option(socket, ENET_SOCKOPT_SNDBUF, ENET_HOST_SEND_BUFFER_SIZE);
+
+            enet_socket_destroy(host->socket);
+            host->socket = socket;
+            host->address = address;
+            return true;
+#else
+            (void)address;
+            return false;
+#endif
+        }
+
+        //Replies to any discovery probes waiting on the side socket.
+        void answerDiscovery()
+        {
+            if (discoverySocket == ENET_SOCKET_NULL)
+            {
+                return;
+            }
+
+            //A whole subnet of browsers can ask at once, so probes come in and replies go out in batches.
+            constexpr size_t Batch = 16;
+            uint8_t data[Batch][DiscoveryProtocol::MaxDatagram];
+            DatagramBatch::Incoming probes[Batch];
+            Packet replies[Batch];
+            DatagramBatch::Outgoing outgoing[Batch];
+
+            info.playerCount = playerCount();
+            for (;;)
+            {
+                for (size_t i = 0; i < Batch; ++i)
+                {
+                    probes[i].data = data[i];
+                    probes[i].capacity = sizeof(data[i]);
+                }
+
+                size_t received = DatagramBatch::receive(discoverySocket, probes, Batch);
+                size_t answers = 0;
+                for (size_t i = 0; i < received; ++i)
+                {
+                    PacketReader r(probes[i].data, probes[i].size);
+                    uint8_t type = 0;
+                    uint32_t nonce = 0;
+                    if (!DiscoveryProtocol::readHeader(r, type, nonce) || type != DiscoveryProtocol::Probe)
+                    {
+                        continue;
+                    }
+
+                    replies[answers] = DiscoveryProtocol::makeReply(nonce, info);
+                    outgoing[answers].to = probes[i].from;
+                    outgoing[answers].packet = &replies[answers];
+                    ++answers;
+                }
+
+                DatagramBatch::send(discoverySocket, outgoing, answers);
+                if (received < Batch)
+                {
+                    break;
+                }
+            }
+        }
+
+        ENetHost* host;
+        uint32_t nextPeerId;
+
+        ENetSocket discoverySocket;
+        ServerInfo info;
+        std::function<uint16_t()> playerCounter;
+        bool reusePort = false;
+
+        ChannelLayout channels;
+        ChannelCounters counters;
+        BandwidthLimits bandwidth;
+        CompressionConfig compression;
+        Checksum checksum = Checksum::None;
+        FlushPolicy flushPolicy = FlushPolicy::Immediate;
+        ServiceStats serviceCounters;
+
+        Backpressure backpressure;
+        BackpressureCallback onBackpressure;
+        std::vector<uint32_t> blockedPeers;
+
+        InboundLimits inboundLimits;
+        RateLimitStats rateLimitTotals;
+        std::unordered_map<uint32_t, PeerLimiter> limiters;
+
+        std::unordered_map<ENetPeer*, uint32_t> peerMap;
+        std::unordered_map<uint32_t, ENetPeer*> idMap;
+
+        ThreadSafeSender queuedSends;
+    };
+
+    //How ShardedServer splits up the work.
+    struct ShardOptions
+    {
+        uint32_t shards = 0;               //0 is one per hardware thread. Anything but Linux runs a single shard
+        uint32_t maxClientsPerShard = 32;
+        bool pinThreads = true;            //Shard i stays on core i (mod core count). Linux only
+        bool discovery = false;            //Shard 0 answers LAN discovery for the whole server
+        uint16_t discoveryPort = DiscoveryProtocol::DefaultPort;
+        uint32_t serviceTimeoutMs = 1;     //How long a shard waits on its socket, also how long a queued send can wait
+        uint32_t maxEvents = 0;            //Per service call, see ServiceOptions
+    };
+
+    //Several NetServers on one port, each on its own thread. The kernel (SO_REUSEPORT) hashes every client
+    //address to one of the sockets, so a client always lands on the same shard and network work spreads over cores.
+    //
+    //Peer ids are global: the top 8 bits are the shard, the rest are the shard's own id.
+    //Events are queued by the shard threads and handed out by poll() on whichever thread calls it.
+    //sendTo/broadcast/disconnect go through each shard's ThreadSafeSender, they can be called from any thread
+    //while the server runs. start() and stop() replace the shards, nothing else may be called during them.
+    class ShardedServer
+    {
+    public:
+        using EventCallback = std::function<void(const NetEvent&)>;
+        using SetupCallback = std::function<void(NetServer& server, uint32_t shard)>;
+
+        static constexpr uint32_t ShardShift = 24;
+        static constexpr uint32_t LocalMask = (1u << ShardShift) - 1;
+        static constexpr uint32_t MaxShards = 256;
+        static_assert(NetServer::MaxPeerId <= LocalMask, "Shard peer ids must fit below the shard bits");
+
+        static uint32_t globalId(uint32_t shard, uint32_t localId) { return (shard << ShardShift) | (localId & LocalMask); }
+        static uint32_t shardOf(uint32_t peerId) { return peerId >> ShardShift; }
+        static uint32_t localIdOf(uint32_t peerId) { return peerId & LocalMask; }
+
+        ShardedServer() : running(false) {}
+        ~ShardedServer() { stop(); }
+
+        ShardedServer(const ShardedServer&) = delete;
+        ShardedServer& operator=(const ShardedServer&) = delete;
+
+        //setup runs for every shard before its host is made, for limits, compression, checksums and the like.
+        bool start(uint16_t port, const ShardOptions& options = ShardOptions(), const ChannelLayout& layout = ChannelLayout::Default(),
+                   const SetupCallback& setup = nullptr)
+        {
+            stop();
+
+            uint32_t cores = std::max(1u, std::thread::hardware_concurrency());
+            uint32_t count = std::min(options.shards ? options.shards : cores, MaxShards);
+#ifndef __linux__
+            if (count > 1)
+            {
+                std::cerr << "Sharing a port between shards needs SO_REUSEPORT (Linux), running one shard\n";
+                count = 1;
+            }
+#endif
+            if (port == 0 && count > 1)
+            {
+                std::cerr << "Shards need a fixed port to share\n";
+                return false;
+            }
+
+            channels = layout;
+            serviceOptions.timeoutMs = options.serviceTimeoutMs;
+            serviceOptions.maxEvents = options.maxEvents;
+
+            for (uint32_t i = 0; i < count; ++i)
+            {
+                std::unique_ptr<Shard> shard = std::make_unique<Shard>();
+                shard->server = std::make_unique<NetServer>();
+                NetServer& server = *shard->server;
+
+                if (setup)
+                {
+                    setup(server, i);
+                }
+                server.setReusePort(count > 1);
+                if (!server.create(port, options.maxClientsPerShard, layout))
+                {
+                    std::cerr << "Failed to start shard " << i << "\n";
+                    shards.clear();
+                    return false;
+                }
+
+                server.setPlayerCounter([this]() { return static_cast<uint16_t>(std::min<size_t>(connectedCount(), 0xFFFF)); });
+                if (i == 0 && options.discovery)
+                {
+                    if (!server.enableDiscovery(options.discoveryPort))
+                    {
+                        std::cerr << "LAN discovery unavailable\n";
+                        server.answerPings();
+                    }
+                }
+                else
+                {
+                    server.answerPings();
+                }
+                shards.push_back(std::move(shard));
+            }
+
+            running = true;
+            for (uint32_t i = 0; i < count; ++i)
+            {
+                shards[i]->worker = std::thread([this, i]() { run(i); });
+                if (options.pinThreads)
+                {
+                    pin(shards[i]->worker, i % cores);
+                }
+            }
+            return true;
+        }
+
+        //Lets the shards send what is still queued, then stops them. Peers are not disconnected.
+        //Destroys the shards, so every other thread has to be done sending (and polling) before this is called.
+        void stop()
+        {
+            running = false;
+            for (auto& shard : shards)
+            {
+                if (shard->worker.joinable())
+                {
+                    shard->worker.join();
+                }
+            }
+            shards.clear();
+        }
+
+        //Hands out everything the shards have received since the last call, with global peer ids.
+        void poll(const EventCallback& cb)
+        {
+            std::vector<NetEvent> events;
+            for (auto& shard : shards)
+            {
+                {
+                    std::lock_guard<std::mutex> lock(shard->mutex);
+                    events.swap(shard->events);
+                }
+                for (const NetEvent& e : events)
+                {
+                    cb(e);
+                }
+                events.clear();
+            }
+        }
+
+        //Queued, so Ok only means the shard exists. See queuedSendStats() for what the shards did with it.
+        SendResult sendTo(uint32_t peerId, const Packet& p, PacketReliability r = PacketReliability::Reliable, int channel = 0)
+        {
+            ThreadSafeSender* sender = senderFor(peerId);
+            return sender ? sender->sendTo(localIdOf(peerId), p, r, channel) : SendResult::NoPeer;
+        }
+
+        //Sends with the delivery mode the channel was declared with.
+        template<typename Channel, EnableIfChannel<Channel> = 0>
+        SendResult sendTo(uint32_t peerId, const Packet& p, Channel channel)
+        {
+            ThreadSafeSender* sender = senderFor(peerId);
+            return sender ? sender->sendTo(localIdOf(peerId), p, channel) : SendResult::NoPeer;
+        }
+
+        void broadcast(const Packet& p, PacketReliability r = PacketReliability::Reliable, int channel = 0)
+        {
+            for (auto& shard : shards)
+            {
+                shard->server->threadSafeSender().broadcast(p, r, channel);
+            }
+        }
+
+        template<typename Channel, EnableIfChannel<Channel> = 0>
+        void broadcast(const Packet& p, Channel channel)
+        {
+            for (auto& shard : shards)
+            {
+                shard->server->threadSafeSender().broadcast(p, channel);
+            }
+        }
+
+        void disconnect(uint32_t peerId, uint32_t data = 0)
+        {
+            ThreadSafeSender* sender = senderFor(peerId);
+            if (sender)
+            {
+                sender->disconnect(localIdOf(peerId), data);
+            }
+        }
+
+        QueuedSendStats queuedSendStats() const
+        {
+            QueuedSendStats total;
+            for (const auto& shard : shards)
+            {
+                QueuedSendStats s = shard->server->queuedSendStats();
+                total.queued += s.queued;
+                total.sent += s.sent;
+                total.failed += s.failed;
+            }
+            return total;
+        }
+
+        size_t connectedCount() const
+        {
+            size_t total = 0;
+            for (const auto& shard : shards)
+            {
+                total += shard->connected.load(std::memory_order_relaxed);
+            }
+            return total;
+        }
+
+        uint32_t shardCount() const { return static_cast<uint32_t>(shards.size()); }
+
+        //Clients on one shard, to see how evenly the kernel spread them.
+        size_t connectedCount(uint32_t shard) const
+        {
+            return shard < shards.size() ? shards[shard]->connected.load(std::memory_order_relaxed) : 0;
+        }
+
+        const ChannelLayout& channelLayout() const { return channels; }
+
+    private:
+        struct Shard
+        {
+            std::unique_ptr<NetServer> server;
+            std::thread worker;
+
+            std::mutex mutex;               //Guards events
+            std::vector<NetEvent> events;
+
+            std::atomic<size_t> connected{ 0 };
+        };
+
+        ThreadSafeSender* senderFor(uint32_t peerId)
+        {
+            uint32_t shard = shardOf(peerId);
+            return shard < shards.size() ? &shards[shard]->server->threadSafeSender() : nullptr;
+        }
+
+        //The shard thread. Owns its NetServer, nothing else touches it while this runs.
+        void run(uint32_t index)
+        {
+            Shard& shard = *shards[index];
+            NetServer& server = *shard.server;
+            std::vector<NetEvent> events;
+
+            auto collect = [&](const NetEvent& e)
+            {
+                events.push_back(e);
+                events.back().peerId = globalId(index, e.peerId);
+            };
+
+            while (running.load(std::memory_order_acquire))
+            {
+                //Queued sends are handed to ENet first thing in here.
+                server.service(serviceOptions, collect);
+                shard.connected.store(server.connectedCount(), std::memory_order_relaxed);
+
+                if (!events.empty())
+                {
+                    std::lock_guard<std::mutex> lock(shard.mutex);
+                    if (shard.events.empty())
+                    {
+                        shard.events.swap(events);
+                    }
+                    else
+                    {
+                        std::move(events.begin(), events.end(), std::back_inserter(shard.events));
+                    }
+                    events.clear();
+                }
+            }
+
+            //Whatever was queued before stop() still goes out.
+            server.flush();
+        }
+
+        static void pin(std::thread& worker, uint32_t core)
+        {
+#ifdef __linux__
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(core, &set);
+            if (pthread_setaffinity_np(worker.native_handle(), sizeof(set), &set) != 0)
+            {
+                std::cerr << "Failed to pin shard to core " << core << "\n";
+            }
+#else
+            (void)worker;
+            (void)core;
+#endif
+        }
+
+        std::atomic<bool> running;
+        ChannelLayout channels;
+        ServiceOptions serviceOptions;
+        std::vector<std::unique_ptr<Shard>> shards;
+    };
+
+    class NetClient 
+    {
+    public:
+        using EventCallback = std::function<void(const NetEvent&)>;
+
+        //How many connection attempts can be in flight at once.
+        static constexpr size_t MaxConnectAttempts = 8;
+
+        //How often nextTimeoutMs wants service while a hostname lookup is running.
+        static constexpr uint32_t LookupPollMs = 5;
+
+        NetClient() : clientHost(nullptr), serverPeer(nullptr), resolver(&Resolver::Shared()), nextAttemptId(1), channels(ChannelLayout::Default()) {}
+        ~NetClient() 
+        {
+            if (clientHost) 
+            {
+                enet_host_destroy(clientHost);
+                clientHost = nullptr;
+            }
+        }
+
+        //Blocking connect, waits up to timeoutMs for the handshake to finish.
+        bool connect(const std::string& host, uint16_t port, uint32_t timeoutMs = 5000) 
+        {
+            if (serverPeer)
+            {
+                std::cerr << "Already connected, disconnect before connecting again\n";
+                return false;
+            }
+
+            //Their events would come out of the wait below and be lost.
+            if (!pendingConnects.empty())
+            {
+                std::cerr << "connectAsync attempts still running, cancel them or wait for service() to report them\n";
+                return false;
+            }
+
+            if (!ensureHost())
+            {
+                return false;
+            }
+
+            ENetAddress address;
+            address.port = port;
+            if (!resolver->resolveNow(host, address.host))
+            {
+                std::cerr << "Failed to resolve host " << host << "\n";
+                return false;
+            }
+
+            ENetPeer* peer = enet_host_connect(clientHost, &address, channels.count(), 0);
+            if (!peer) 
+            {
+                std::cerr << "No available peers for initiating connection\n";
+                return false;
+            }
+
+            ENetEvent event;
+            if (enet_host_service(clientHost, &event, timeoutMs) > 0 && event.type == ENET_EVENT_TYPE_CONNECT && event.peer == peer) 
+            {
+                //The handshake ack may still be queued.
+                HostBatching::send(clientHost);
+                serverPeer = peer;
+                bandwidth.apply(serverPeer);
+                return true;
+            }
+
+            dropPeer(peer);
+            return false;
+        }
+
+        //Starts a connection attempt and returns straight away.
+        //The outcome is reported through service(): Connect with peerId set to the returned attempt id, or
+        //ConnectFailed with the reason. Several attempts may be in flight, the first to connect becomes
+        //the server and the others are cancelled. Returns 0 if the attempt could not be started, including
+        //when MaxConnectAttempts are already running (lookups count, so do a connected server).
+        //Hostnames are looked up on the resolver's worker pool, so this never blocks on DNS either.
+        uint32_t connectAsync(const std::string& host, uint16_t port, uint32_t timeoutMs = 5000)
+        {
+            if (!ensureHost())
+            {
+                return 0;
+            }
+
+            //Every attempt needs an ENet peer once its lookup is done, so they all take a slot now.
+            if (pendingConnects.size() + (serverPeer ? 1 : 0) >= MaxConnectAttempts)
+            {
+                std::cerr << "Too many connection attempts, " << MaxConnectAttempts << " max\n";
+                return 0;
+            }
+
+            PendingConnect pending;
+            pending.id = nextAttemptId++;
+            pending.port = port;
+            pending.deadline = enet_time_get() + timeoutMs;
+
+            enet_uint32 address = 0;
+            if (resolver->lookupCached(host, address))
+            {
+                pending.peer = startConnect(address, port);
+                if (!pending.peer)
+                {
+                    return 0;
+                }
+            }
+            else
+            {
+                pending.lookup = resolver->resolveAsync(host);
+            }
+
+            pendingConnects.push_back(pending);
+            return pending.id;
+        }
+
+        //Channel table asked for on connect, ChannelLayout::Default() otherwise. Should match the server's.
+        //Only takes effect before the first connect, returns false after that.
+        bool setChannelLayout(const ChannelLayout& layout)
+        {
+            if (clientHost)
+            {
+                std::cerr << "Channel layout must be set before connecting\n";
+                return false;
+            }
+
+            channels = layout;
+            return true;
+        }
+
+        const ChannelLayout& channelLayout() const { return channels; }
+
+        ChannelStats channelStats(uint8_t channel) const { return counters.get(channel); }
+
+        template<typename Channel, EnableIfChannel<Channel> = 0>
+        ChannelStats channelStats(Channel channel) const { return counters.get(static_cast<uint8_t>(channel)); }
+
+        //Link to the server, false while not connected.
+        bool peerStats(PeerStats& out) const
+        {
+            if (!serverPeer)
+            {
+                return false;
+            }
+            out = PeerStats::of(serverPeer);
+            return true;
+        }
+
+        //Applies bandwidth limits and throttle settings, now if connected and to later connections.
+        void setBandwidthLimits(const BandwidthLimits& limits)
+        {
+            bandwidth = limits;
+            if (clientHost)
+            {
+                bandwidth.apply(clientHost);
+            }
+        }
+
+        //Compresses datagrams with mode, must match the server's. Best set before connecting.
+        bool setCompression(Compression mode)
+        {
+            compression.mode = mode;
+            return !clientHost || PacketCompressor::install(clientHost, compression);
+        }
+
+        //Switches to Compression::Trained with model, e.g. TrainedModel::load("game.model"). Both ends need the same model.
+        bool setCompressionModel(std::shared_ptr<const TrainedModel> model)
+        {
+            compression.mode = Compression::Trained;
+            compression.model = std::move(model);
+            return !clientHost || PacketCompressor::install(clientHost, compression);
+        }
+
+        //Records every outgoing datagram to path for Tools/TrafficTrainer. Empty path stops recording.
+        bool captureTraffic(const std::string& path)
+        {
+            compression.capturePath = path;
+            return !clientHost || PacketCompressor::install(clientHost, compression);
+        }
+
+        //Checksums every datagram, must match the other end. Set it before connections are made.
+        void setChecksum(Checksum mode)
+        {
+            checksum = mode;
+            if (clientHost)
+            {
+                clientHost->checksum = mode == Checksum::Crc32c ? &Crc32c::enetChecksum : NULL;
+            }
+        }
+
+        //Coalesced lets several sends in one tick share a datagram, they go out on the next service() or flush().
+        void setFlushPolicy(FlushPolicy policy) { flushPolicy = policy; }
+
+        //Hands everything queued to the socket now.
+        void flush()
+        {
+            if (clientHost)
+            {
+                HostBatching::flush(clientHost);
+            }
+        }
+
+        IoStats ioStats() const { return IoStats::of(clientHost); }
+
+        CompressionStats compressionStats() const { return PacketCompressor::statsOf(clientHost); }
+
+        using BackpressureCallback = std::function<void(size_t queuedBytes)>;
+
+        //Same as NetServer::setBackpressure, for the connection to the server.
+        void setBackpressure(size_t highWater, size_t lowWater, BackpressureCallback onBlocked = nullptr)
+        {
+            backpressure.highWater = highWater;
+            backpressure.lowWater = std::min(lowWater, highWater);
+            onBackpressure = std::move(onBlocked);
+            if (!highWater)
+            {
+                blocked = false;
+            }
+        }
+
+        size_t queuedBytes() const { return serverPeer ? Backpressure::queuedBytes(serverPeer) : 0; }
+        bool isBlocked() const { return blocked; }
+
+        //How many bytes to send the server this tick, see BandwidthLimits::budget. 0 when not connected.
+        uint32_t sendBudget(uint32_t tickMs) const
+        {
+            return serverPeer ? bandwidth.budget(clientHost, serverPeer, tickMs) : 0;
+        }
+
+        //Resolver used for hostnames, Resolver::Shared() by default. Must outlive the client.
+        void setResolver(Resolver& r) { resolver = &r; }
+
+        //Abandons an attempt started with connectAsync. Reported as ConnectFailed/Cancelled on the next service().
+        void cancelConnect(uint32_t attemptId)
+        {
+            for (PendingConnect& p : pendingConnects)
+            {
+                if (p.id == attemptId)
+                {
+                    p.cancelled = true;
+                }
+            }
+        }
+
+        bool isConnected() const { return serverPeer != nullptr; }
+        size_t pendingConnectCount() const { return pendingConnects.size(); }
+
+        void service(uint32_t timeoutMs, const EventCallback& cb) 
+        {
+            ServiceOptions options;
+            options.timeoutMs = timeoutMs;
+            service(options, cb);
+        }
+
+        //Same as above, but stops handing out events at options.maxEvents or after options.budgetUs.
+        //The rest stay queued for the next call, serviceStats() counts them.
+        void service(const ServiceOptions& options, const EventCallback& cb)
+        {
+            if (!clientHost)
+            {
+                return;
+            }
+
+            advanceLookups(cb);
+            expireConnects(cb);
+
+            ServiceOptions::drain(clientHost, options, serviceCounters, [&](const ENetEvent& event) { dispatch(event, cb); });
+
+            advanceLookups(cb);
+            expireConnects(cb);
+
+            if (blocked && (!serverPeer || Backpressure::queuedBytes(serverPeer) <= backpressure.lowWater))
+            {
+                blocked = false;
+                if (serverPeer)
+                {
+                    NetEvent e;
+                    e.type = NetEvent::Writable;
+                    e.peerId = 0;
+                    cb(e);
+                }
+            }
+        }
+
+        const ServiceStats& serviceStats() const { return serviceCounters; }
+
+        //Same as NetServer's: wait for socketHandle() to be readable or nextTimeoutMs() to run out in your
+        //own poll/epoll loop, then call processReadable(). The socket exists once connect/connectAsync is called.
+        ENetSocket socketHandle() const { return clientHost ? clientHost->socket : ENET_SOCKET_NULL; }
+
+        uint32_t nextTimeoutMs(uint32_t maxMs = 1000) const
+        {
+            if (!clientHost)
+            {
+                return maxMs;
+            }
+
+            uint32_t wait = ServiceOptions::nextTimeoutMs(clientHost, maxMs);
+            enet_uint32 now = enet_time_get();
+            for (const PendingConnect& p : pendingConnects)
+            {
+                //Hostname lookups finish on the resolver's threads without touching the socket, so they get polled.
+                if (!p.peer)
+                {
+                    wait = std::min<uint32_t>(wait, LookupPollMs);
+                }
+                int32_t left = static_cast<int32_t>(p.deadline - now);
+                wait = std::min<uint32_t>(wait, left > 0 ? static_cast<uint32_t>(left) : 0);
+            }
+            return wait;
+        }
+
+        //Non-blocking receive, send and dispatch. Same as service() with a zero timeout.
+        void processReadable(const EventCallback& cb, const ServiceOptions& limits = ServiceOptions())
+        {
+            ServiceOptions options = limits;
+            options.timeoutMs = 0;
+            service(options, cb);
+        }
+
+        SendResult send(const Packet& p, PacketReliability r = PacketReliability::Reliable, int channel = 0) 
+        {
+            if (!checkChannel(channel))
+            {
+                return SendResult::Failed;
+            }
+            return sendOn(p, static_cast<uint8_t>(channel), channels.flags(static_cast<uint8_t>(channel), r));
+        }
+
+        //Sends with the delivery mode the channel was declared with.
+        template<typename Channel, EnableIfChannel<Channel> = 0>
+        SendResult send(const Packet& p, Channel channel)
+        {
+            if (!checkChannel(static_cast<int>(channel)))
+            {
+                return SendResult::Failed;
+            }
+            uint8_t id = static_cast<uint8_t>(channel);
+            return sendOn(p, id, channels.flags(id));
+        }
+
+        void disconnect(uint32_t data = 0) 
+        {
+            if (serverPeer)
+            {
+                enet_peer_disconnect(serverPeer, data);
+            }
+        }
+
+    private:
+
+        struct PendingConnect
+        {
+            uint32_t id = 0;
+            ENetPeer* peer = nullptr;  //Null while the hostname is still being looked up
+            std::shared_ptr<const ResolveResult> lookup;
+            uint16_t port = 0;
+            enet_uint32 deadline = 0;
+            bool cancelled = false;
+        };
+
+        bool checkChannel(int channel) const
+        {
+            if (!channels.valid(channel))
+            {
+                std::cerr << "Channel " << channel << " is not in this client's layout (" << channels.count() << " channels)\n";
+                return false;
+            }
+            return true;
+        }
+
+        SendResult sendOn(const Packet& p, uint8_t channel, enet_uint32 flags)
+        {
+            if (!serverPeer)
+            {
+                return SendResult::NoPeer;
+            }
+
+            if (backpressure.highWater)
+            {
+                if (blocked)
+                {
+                    return SendResult::WouldBlock;
+                }
+
+                size_t queued = Backpressure::queuedBytes(serverPeer);
+                if (queued >= backpressure.highWater)
+                {
+                    blocked = true;
+                    if (onBackpressure)
+                    {
+                        onBackpressure(queued);
+                    }
+                    return SendResult::WouldBlock;
+                }
+            }
+
+            ENetPacket* packet = enet_packet_create(p.data.data(), p.data.size(), flags);
+            if (!packet)
+            {
+                return SendResult::Failed;
+            }
+
+            if (enet_peer_send(serverPeer, channel, packet) < 0)
+            {
+                //Server negotiated fewer channels than the layout has.
+                enet_packet_destroy(packet);
+                return SendResult::Failed;
+            }
+            counters.sent(channel, p.data.size());
+            if (flushPolicy == FlushPolicy::Immediate)
+            {
+                HostBatching::flush(clientHost);
+            }
+
+            return SendResult::Ok;
+        }
+
+        bool ensureHost()
+        {
+            if (clientHost)
+            {
+                return true;
+            }
+
+            clientHost = enet_host_create(NULL, MaxConnectAttempts, channels.count(), bandwidth.incoming, bandwidth.outgoing);
+            if (!clientHost) 
+            {
+                std::cerr << "Failed to create ENet client host\n";
+                return false;
+            }
+            HostBatching::enable(clientHost);
+
+            counters.reset(channels.count());
+
+            if (!PacketCompressor::install(clientHost, compression))
+            {
+                std::cerr << "Failed to set up compression, sending uncompressed\n";
+            }
+            setChecksum(checksum);
+            return true;
+        }
+
+        ENetPeer* startConnect(enet_uint32 host, uint16_t port)
+        {
+            ENetAddress address;
+            address.host = host;
+            address.port = port;
+
+            ENetPeer* peer = enet_host_connect(clientHost, &address, channels.count(), 0);
+            if (!peer)
+            {
+                std::cerr << "No available peers for initiating connection\n";
+            }
+            return peer;
+        }
+
+        //Starts the handshake for attempts whose hostname lookup has finished.
+        void advanceLookups(const EventCallback& cb)
+        {
+            for (size_t i = 0; i < pendingConnects.size();)
+            {
+                PendingConnect& p = pendingConnects[i];
+                if (p.peer || p.cancelled || !p.lookup->done())
+                {
+                    ++i;
+                    continue;
+                }
+
+                if (p.lookup->succeeded())
+                {
+                    p.peer = startConnect(p.lookup->host(), p.port);
+                }
+
+                if (!p.peer)
+                {
+                    uint32_t id = p.id;
+                    ConnectError error = p.lookup->succeeded() ? ConnectError::NoSlot : ConnectError::Unresolved;
+                    pendingConnects.erase(pendingConnects.begin() + i);
+                    failConnect(id, error, cb);
+                    continue;
+                }
+
+                p.lookup.reset();
+                ++i;
+            }
+        }
+
+        void dispatch(const ENetEvent& event, const EventCallback& cb)
+        {
+            switch (event.type)
+            {
+            case ENET_EVENT_TYPE_CONNECT:
+            {
+                auto it = findPending(event.peer);
+                if (it == pendingConnects.end())
+                {
+                    break;
+                }
+
+                PendingConnect done = *it;
+                pendingConnects.erase(it);
+
+                //Someone else won the race, or the caller gave up on this one already.
+                if (serverPeer || done.cancelled)
+                {
+                    dropPeer(done.peer);
+                    failConnect(done.id, ConnectError::Cancelled, cb);
+                    break;
+                }
+
+                serverPeer = done.peer;
+                bandwidth.apply(serverPeer);
+
+                NetEvent e;
+                e.type = NetEvent::Connect;
+                e.peerId = done.id;
+                cb(e);
+
+                cancelPending(cb);
+                break;
+            }
+            case ENET_EVENT_TYPE_DISCONNECT:
+            {
+                auto it = findPending(event.peer);
+                if (it != pendingConnects.end())
+                {
+                    uint32_t id = it->id;
+                    pendingConnects.erase(it);
+                    failConnect(id, ConnectError::Refused, cb);
+                    break;
+                }
+
+                if (event.peer != serverPeer)
+                {
+                    break;
+                }
+                serverPeer = nullptr;
+
+                NetEvent e;
+                e.type = NetEvent::Disconnect;
+                e.peerId = 0;
+                cb(e);
+
+                break;
+            }
+            case ENET_EVENT_TYPE_RECEIVE:
+            {
+                NetEvent e;
+                e.type = NetEvent::Receive;
+                e.peerId = 0;
+                e.channel = event.channelID;
+                e.packet.data.resize(event.packet->dataLength);
+
+                std::memcpy(e.packet.data.data(), event.packet->data, event.packet->dataLength);
+                counters.received(event.channelID, event.packet->dataLength);
+                cb(e);
+                enet_packet_destroy(event.packet);
+
+                break;
+            }
+            default:
+            {
+                break;
+            }
+            }
+        }
+
+        std::vector<PendingConnect>::iterator findPending(ENetPeer* peer)
+        {
+            for (auto it = pendingConnects.begin(); it != pendingConnects.end(); ++it)
+            {
+                if (it->peer == peer)
+                {
+                    return it;
+                }
+            }
+            return pendingConnects.end();
+        }
+
+        //Times out or cancels attempts that are past their deadline.
+        void expireConnects(const EventCallback& cb)
+        {
+            enet_uint32 now = enet_time_get();
+
+            for (size_t i = 0; i < pendingConnects.size();)
+            {
+                PendingConnect p = pendingConnects[i];
+                bool expired = static_cast<int32_t>(now - p.deadline) >= 0;
+
+                if (!p.cancelled && !expired)
+                {
+                    ++i;
+                    continue;
+                }
+
+                pendingConnects.erase(pendingConnects.begin() + i);
+                if (p.peer)
+                {
+                    dropPeer(p.peer);
+                }
+                failConnect(p.id, p.cancelled ? ConnectError::Cancelled : ConnectError::Timeout, cb);
+            }
+        }
+
+        void cancelPending(const EventCallback& cb)
+        {
+            std::vector<PendingConnect> rest;
+            rest.swap(pendingConnects);
+
+            for (const PendingConnect& p : rest)
+            {
+                if (p.peer)
+                {
+                    dropPeer(p.peer);
+                }
+                failConnect(p.id, ConnectError::Cancelled, cb);
+            }
+        }
+
+        //Gives up on an attempt. Once the server has answered it holds a peer for us too, so it gets told,
+        //a reset alone would leave that slot taken until it times out.
+        void dropPeer(ENetPeer* peer)
+        {
+            if (peer->state > ENET_PEER_STATE_CONNECTING)
+            {
+                enet_peer_disconnect_now(peer, 0);
+                HostBatching::send(clientHost);
+            }
+            else
+            {
+                enet_peer_reset(peer);
+            }
+        }
+
+        void failConnect(uint32_t attemptId, ConnectError error, const EventCallback& cb)
+        {
+            NetEvent e;
+            e.type = NetEvent::ConnectFailed;
+            e.peerId = attemptId;
+            e.error = error;
+            cb(e);
+        }
 
         ENetHost* clientHost;
         ENetPeer* serverPeer;
+        Resolver* resolver;
+
+        uint32_t nextAttemptId;
+        std::vector<PendingConnect> pendingConnects;
+
+        ChannelLayout channels;
+        ChannelCounters counters;
+        BandwidthLimits bandwidth;
+        CompressionConfig compression;
+        Checksum checksum = Checksum::None;
+        FlushPolicy flushPolicy = FlushPolicy::Immediate;
+        ServiceStats serviceCounters;
+
+        Backpressure backpressure;
+        BackpressureCallback onBackpressure;
+        bool blocked = false;
+    };
+
+    //Finds servers on the local network.
+    //Broadcasts a probe to the discovery port and collects replies from every server that answers.
+    class LanDiscovery
+    {
+    public:
+        LanDiscovery() : socket(ENET_SOCKET_NULL), nonce(0) {}
+        ~LanDiscovery() { close(); }
+
+        LanDiscovery(const LanDiscovery&) = delete;
+        LanDiscovery& operator=(const LanDiscovery&) = delete;
+
+        //Sends the probe. Replies are picked up by poll()/discover().
+        bool start(uint16_t discoveryPort = DiscoveryProtocol::DefaultPort)
+        {
+            close();
+            found.clear();
+
+            socket = enet_socket_create(ENET_SOCKET_TYPE_DATAGRAM);
+            if (socket == ENET_SOCKET_NULL)
+            {
+                std::cerr << "Failed to create discovery socket\n";
+                return false;
+            }
+
+            enet_socket_set_option(socket, ENET_SOCKOPT_NONBLOCK, 1);
+            enet_socket_set_option(socket, ENET_SOCKOPT_BROADCAST, 1);
+
+            nonce = enet_time_get() ^ static_cast<uint32_t>(reinterpret_cast<uintptr_t>(this));
+            Packet probe = DiscoveryProtocol::makeProbe(nonce);
+
+            //Broadcast for the LAN, and the loopback broadcast for servers on this machine. A unicast to
+            //127.0.0.1 would only reach one of the servers sharing the discovery port.
+            ENetAddress to;
+            to.host = ENET_HOST_BROADCAST;
+            to.port = discoveryPort;
+            bool sent = DiscoveryProtocol::sendTo(socket, to, probe);
+
+            enet_address_set_host_ip(&to, "127.255.255.255");
+            sent = DiscoveryProtocol::sendTo(socket, to, probe) || sent;
+
+            return sent;
+        }
+
+        //Collects replies that have arrived so far without blocking. Returns true if anything new came in.
+        bool poll()
+        {
+            if (socket == ENET_SOCKET_NULL)
+            {
+                return false;
+            }
+
+            bool any = false;
+            uint8_t data[DiscoveryProtocol::MaxDatagram];
+
+            for (;;)
+            {
+                ENetAddress from;
+                ENetBuffer buffer;
+                buffer.data = data;
+                buffer.dataLength = sizeof(data);
+
+                int received = enet_socket_receive(socket, &from, &buffer, 1);
+                if (received <= 0)
+                {
+                    break;
+                }
+
+                PacketReader r(data, static_cast<size_t>(received));
+                uint8_t type = 0;
+                uint32_t replyNonce = 0;
+                ServerInfo info;
+
+                if (!DiscoveryProtocol::readHeader(r, type, replyNonce) || type != DiscoveryProtocol::Reply || replyNonce != nonce || !DiscoveryProtocol::readReply(r, info))
+                {
+                    continue;
+                }
+
+                info.address.host = from.host;
+                info.address.port = info.port;
+                any = add(info) || any;
+            }
+
+            return any;
+        }
+
+        //Probes and collects replies for timeoutMs, or until maxServers have answered.
+        const std::vector<ServerInfo>& discover(uint32_t timeoutMs = 250, size_t maxServers = 0, uint16_t discoveryPort = DiscoveryProtocol::DefaultPort)
+        {
+            if (!start(discoveryPort))
+            {
+                return found;
+            }
+
+            enet_uint32 deadline = enet_time_get() + timeoutMs;
+            for (;;)
+            {
+                poll();
+                if (maxServers && found.size() >= maxServers)
+                {
+                    break;
+                }
+
+                enet_uint32 now = enet_time_get();
+                if (static_cast<int32_t>(deadline - now) <= 0)
+                {
+                    break;
+                }
+
+                enet_uint32 wait = ENET_SOCKET_WAIT_RECEIVE;
+                enet_socket_wait(socket, &wait, deadline - now);
+            }
+
+            close();
+            return found;
+        }
+
+        const std::vector<ServerInfo>& servers() const { return found; }
+
+        void close()
+        {
+            if (socket != ENET_SOCKET_NULL)
+            {
+                enet_socket_destroy(socket);
+                socket = ENET_SOCKET_NULL;
+            }
+        }
+
+    private:
+        //A server on this machine answers both probes, once from its LAN address and once from loopback.
+        //Those replies carry the same instance, other servers on the same port won't.
+        bool add(const ServerInfo& info)
+        {
+            for (ServerInfo& known : found)
+            {
+                if (known.address.port == info.address.port && (known.address.host == info.address.host || known.instance == info.instance))
+                {
+                    return false;
+                }
+            }
+
+            found.push_back(info);
+            return true;
+        }
+
+        ENetSocket socket;
+        uint32_t nonce;
+        std::vector<ServerInfo> found;
+    };
+
+    //How a candidate did in ServerBrowser::rank.
+    struct BrowseResult
+    {
+        ServerInfo info;           //As reported in the server's pong (address is the candidate's)
+        bool reachable = false;    //At least one pong came back
+        uint32_t sent = 0;
+        uint32_t received = 0;
+        float loss = 1.0f;         //1 - received/sent
+        float rttMs = 0.0f;        //Median of the samples
+        float minRttMs = 0.0f;
+        float score = 0.0f;        //Lower is better, what the list is sorted by
+    };
+
+    //Pings candidate servers in parallel and ranks them.
+    //All probes go out from one unconnected socket and are answered by the servers' ENet intercept
+    //hook (see NetServer::enableDiscovery), so no connection is made to any of them.
+    class ServerBrowser
+    {
+    public:
+        void addCandidate(const ENetAddress& address)
+        {
+            Candidate c;
+            c.address = address;
+            candidates.push_back(c);
+        }
+
+        //Hostnames are only taken if they are IP literals or already in the resolver cache.
+        bool addCandidate(const std::string& hostName, uint16_t port, Resolver& resolver = Resolver::Shared())
+        {
+            ENetAddress address;
+            address.port = port;
+            if (!resolver.lookupCached(hostName, address.host))
+            {
+                return false;
+            }
+
+            addCandidate(address);
+            return true;
+        }
+
+        void addCandidates(const std::vector<ServerInfo>& servers)
+        {
+            for (const ServerInfo& s : servers)
+            {
+                addCandidate(s.address);
+            }
+        }
+
+        void clear() { candidates.clear(); }
+        size_t candidateCount() const { return candidates.size(); }
+
+        //Sends probesPerServer pings to every candidate, intervalMs apart, and collects pongs until
+        //deadlineMs has passed or everything has answered. Best server first.
+        std::vector<BrowseResult> rank(uint32_t deadlineMs = 500, uint32_t probesPerServer = 4, uint32_t intervalMs = 20)
+        {
+            std::vector<BrowseResult> results;
+            if (candidates.empty() || probesPerServer == 0)
+            {
+                return results;
+            }
+
+            ENetSocket socket = enet_socket_create(ENET_SOCKET_TYPE_DATAGRAM);
+            if (socket == ENET_SOCKET_NULL)
+            {
+                std::cerr << "Failed to create server browser socket\n";
+                return results;
+            }
+            enet_socket_set_option(socket, ENET_SOCKOPT_NONBLOCK, 1);
+
+            using Clock = std::chrono::steady_clock;
+            Clock::time_point start = Clock::now();
+            Clock::time_point deadline = start + std::chrono::milliseconds(deadlineMs);
+
+            //Nonce = base + candidate * probes + probe, so a pong maps straight back to its slot.
+            uint32_t base = enet_time_get() * 2654435761u;
+            std::vector<Clock::time_point> sentAt(candidates.size() * probesPerServer);
+            std::vector<float> rtt(sentAt.size(), -1.0f);
+
+            for (Candidate& c : candidates)
+            {
+                c.sent = 0;
+                c.received = 0;
+                c.hasInfo = false;
+            }
+
+            uint32_t round = 0;
+            uint32_t outstanding = 0;
+            Clock::time_point nextRound = start;
+
+            for (;;)
+            {
+                Clock::time_point now = Clock::now();
+
+                if (round < probesPerServer && now >= nextRound)
+                {
+                    //One ping per candidate, handed to the socket together.
+                    std::vector<Packet> pings(candidates.size());
+                    std::vector<DatagramBatch::Outgoing> outgoing(candidates.size());
+                    for (size_t i = 0; i < candidates.size(); ++i)
+                    {
+                        pings[i] = DiscoveryProtocol::makePing(base + static_cast<uint32_t>(i * probesPerServer + round));
+                        outgoing[i].to = candidates[i].address;
+                        outgoing[i].packet = &pings[i];
+                    }
+
+                    Clock::time_point sendTime = Clock::now();
+                    DatagramBatch::send(socket, outgoing.data(), outgoing.size());
+                    for (size_t i = 0; i < outgoing.size(); ++i)
+                    {
+                        if (!outgoing[i].sent)
+                        {
+                            continue;
+                        }
+                        sentAt[i * probesPerServer + round] = sendTime;
+                        ++candidates[i].sent;
+                        ++outstanding;
+                    }
+                    ++round;
+                    nextRound = now + std::chrono::milliseconds(intervalMs);
+                }
+
+                outstanding -= collect(socket, base, probesPerServer, sentAt, rtt);
+
+                now = Clock::now();
+                if (now >= deadline || (round == probesPerServer && outstanding == 0))
+                {
+                    break;
+                }
+
+                //Never past the deadline. The next round can already be due (collect took a while, or
+                //intervalMs is 0), a negative wait must not turn into a huge unsigned one.
+                Clock::time_point wakeAt = round < probesPerServer ? std::min(nextRound, deadline) : deadline;
+                long long left = std::chrono::duration_cast<std::chrono::milliseconds>(wakeAt - now).count();
+                enet_uint32 waitMs = left <= 0 ? 1 : static_cast<enet_uint32>(left);
+                enet_uint32 condition = ENET_SOCKET_WAIT_RECEIVE;
+                enet_socket_wait(socket, &condition, waitMs);
+            }
+
+            enet_socket_destroy(socket);
+
+            for (size_t i = 0; i < candidates.size(); ++i)
+            {
+                results.push_back(summarize(i, probesPerServer, rtt));
+            }
+
+            std::stable_sort(results.begin(), results.end(), [](const BrowseResult& a, const BrowseResult& b)
+            {
+                if (a.reachable != b.reachable)
+                {
+                    return a.reachable;
+                }
+                return a.score < b.score;
+            });
+            return results;
+        }
+
+    private:
+        struct Candidate
+        {
+            ENetAddress address;
+            uint32_t sent = 0;
+            uint32_t received = 0;
+            bool hasInfo = false;
+            ServerInfo info;
+        };
+
+        //Drains pongs that have arrived. Returns how many matched an outstanding probe.
+        uint32_t collect(ENetSocket socket, uint32_t base, uint32_t probesPerServer,
+            const std::vector<std::chrono::steady_clock::time_point>& sentAt, std::vector<float>& rtt)
+        {
+            uint32_t matched = 0;
+            constexpr size_t Batch = 32;
+            uint8_t data[Batch][DiscoveryProtocol::MaxDatagram];
+            DatagramBatch::Incoming pongs[Batch];
+            size_t received = 0;
+            size_t next = 0;
+
+            for (;;)
+            {
+                if (next == received)
+                {
+                    if (received != 0 && received < Batch)
+                    {
+                        break;
+                    }
+                    for (size_t i = 0; i < Batch; ++i)
+                    {
+                        pongs[i].data = data[i];
+                        pongs[i].capacity = sizeof(data[i]);
+                    }
+                    received = DatagramBatch::receive(socket, pongs, Batch);
+                    next = 0;
+                    if (received == 0)
+                    {
+                        break;
+                    }
+                }
+                const DatagramBatch::Incoming& pong = pongs[next++];
+
+                PacketReader r(pong.data, pong.size);
+                uint8_t type = 0;
+                uint32_t nonce = 0;
+                ServerInfo info;
+                if (!DiscoveryProtocol::readHeader(r, type, nonce) || type != DiscoveryProtocol::Pong || !DiscoveryProtocol::readReply(r, info))
+                {
+                    continue;
+                }
+
+                size_t slot = static_cast<size_t>(nonce - base);
+                if (slot >= rtt.size() || rtt[slot] >= 0.0f)
+                {
+                    continue;
+                }
+
+                rtt[slot] = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - sentAt[slot]).count();
+
+                Candidate& c = candidates[slot / probesPerServer];
+                ++c.received;
+                c.info = info;
+                c.hasInfo = true;
+                ++matched;
+            }
+
+            return matched;
+        }
+
+        BrowseResult summarize(size_t index, uint32_t probesPerServer, const std::vector<float>& rtt) const
+        {
+            const Candidate& c = candidates[index];
+            BrowseResult out;
+            out.info = c.info;
+            out.info.address = c.address;
+            out.sent = c.sent;
+            out.received = c.received;
+            out.reachable = c.received > 0;
+
+            if (!out.reachable)
+            {
+                return out;
+            }
+
+            std::vector<float> samples;
+            for (uint32_t k = 0; k < probesPerServer; ++k)
+            {
+                float v = rtt[index * probesPerServer + k];
+                if (v >= 0.0f)
+                {
+                    samples.push_back(v);
+                }
+            }
+            std::sort(samples.begin(), samples.end());
+
+            out.rttMs = samples[samples.size() / 2];
+            out.minRttMs = samples.front();
+            out.loss = c.sent ? 1.0f - static_cast<float>(c.received) / c.sent : 1.0f;
+
+            //Latency first, then penalties for loss, load and being full.
+            out.score = out.rttMs + out.loss * 200.0f + (c.info.load / 255.0f) * 50.0f;
+            if (c.info.maxPlayers && c.info.playerCount >= c.info.maxPlayers)
+            {
+                out.score += 10000.0f;
+            }
+            return out;
+        }
+
+        std::vector<Candidate> candidates;
+    };
+
+    //Rates for TickScheduler. Network and render at 0 run once after every batch of simulation ticks.
+    struct TickRates
+    {
+        uint32_t simulationHz = 60;
+        uint32_t networkHz = 0;
+        uint32_t renderHz = 0;
+        uint32_t maxCatchUp = 5;  //Simulation ticks run back to back after a stall, anything further behind is dropped
+        uint32_t spinUs = 1500;   //Sleeps until this close to a deadline, then spins. 0 only sleeps
+    };
+
+    struct TickStats
+    {
+        uint64_t simulationTicks = 0;
+        uint64_t networkTicks = 0;
+        uint64_t renderFrames = 0;
+        uint64_t droppedTicks = 0;     //Simulation ticks given up on after maxCatchUp
+        uint64_t overruns = 0;         //Steps whose work took longer than one simulation tick
+        double lastWorkMs = 0.0;       //Time spent in the callbacks by the last step
+        double worstWorkMs = 0.0;
+        double meanWorkMs = 0.0;
+        double totalWorkSeconds = 0.0;
+        double worstWakeLateUs = 0.0;  //How far past a deadline step() woke up
+        double meanWakeLateUs = 0.0;
+    };
+
+    //Passed to the overrun callback for a step that took longer than a simulation tick.
+    struct TickOverrun
+    {
+        uint64_t simulationTick = 0;  //Index of the last simulation tick the step ran
+        uint32_t simulationTicks = 0; //How many it ran, more than 1 when catching up
+        double workMs = 0.0;
+        double budgetMs = 0.0;
+    };
+
+    //Fixed timestep loop driver. Simulation ticks run at exactly simulationHz on average: deadlines are
+    //kept on a fixed grid from the start, so time spent working never pushes later ticks back. After a
+    //stall up to maxCatchUp ticks run back to back, the rest are dropped and counted.
+    //Network and render run on their own rates (or after each simulation batch) and never catch up,
+    //only the newest state matters for them.
+    //Waiting sleeps until spinUs before the deadline then spins, OS sleeps are only accurate to about a
+    //millisecond (ENet's initialize sets the Windows timer to 1 ms).
+    class TickScheduler
+    {
+    public:
+        using Clock = std::chrono::steady_clock;
+        using SimulateFn = std::function<void(double dtSeconds)>;
+        using NetworkFn = std::function<void()>;
+        using RenderFn = std::function<void(double alpha)>;  //alpha: 0-1 of the way to the next simulation tick
+        using OverrunFn = std::function<void(const TickOverrun&)>;
+
+        explicit TickScheduler(uint32_t simulationHz = 60) : TickScheduler(ratesAt(simulationHz)) {}
+
+        explicit TickScheduler(const TickRates& tickRates) : rates(tickRates)
+        {
+            rates.simulationHz = std::max<uint32_t>(rates.simulationHz, 1);
+            rates.maxCatchUp = std::max<uint32_t>(rates.maxCatchUp, 1);
+            simPeriod = periodOf(rates.simulationHz);
+            netPeriod = rates.networkHz ? periodOf(rates.networkHz) : simPeriod;
+            renderPeriod = rates.renderHz ? periodOf(rates.renderHz) : simPeriod;
+        }
+
+        void onOverrun(OverrunFn fn) { overrunCallback = std::move(fn); }
+
+        //Starts the schedule from now, e.g. after a long load. step() does this on its first call.
+        void reset()
+        {
+            Clock::time_point now = Clock::now();
+            simNext = now;
+            netNext = now;
+            renderNext = now;
+            started = true;
+        }
+
+        //Waits for the next deadline and runs whatever is due. Call it in a loop. Empty callbacks are skipped.
+        void step(const SimulateFn& simulate, const NetworkFn& network = NetworkFn(), const RenderFn& render = RenderFn())
+        {
+            if (!started)
+            {
+                reset();
+            }
+
+            Clock::time_point wake = simNext;
+            if (rates.networkHz && network) wake = std::min(wake, netNext);
+            if (rates.renderHz && render) wake = std::min(wake, renderNext);
+            waitUntil(wake);
+
+            Clock::time_point now = Clock::now();
+            recordWake(now - wake);
+
+            uint32_t ran = 0;
+            while (now >= simNext && ran < rates.maxCatchUp)
+            {
+                if (simulate)
+                {
+                    simulate(dtSeconds());
+                }
+                simNext += simPeriod;
+                ++ran;
+                ++statistics.simulationTicks;
+            }
+            statistics.droppedTicks += skipMissed(simNext, simPeriod, now);
+
+            if (network && (rates.networkHz ? due(netNext, netPeriod, now) : ran > 0))
+            {
+                network();
+                ++statistics.networkTicks;
+            }
+
+            if (render && (rates.renderHz ? due(renderNext, renderPeriod, now) : ran > 0))
+            {
+                render(alpha());
+                ++statistics.renderFrames;
+            }
+
+            recordWork(Clock::now() - now, ran);
+        }
+
+        double dtSeconds() const { return 1.0 / rates.simulationHz; }
+        uint32_t simulationPeriodMs() const { return std::max<uint32_t>(1, 1000 / rates.simulationHz); }
+
+        //Time between network ticks, what a per-tick send budget should cover.
+        uint32_t networkPeriodMs() const
+        {
+            return static_cast<uint32_t>(std::max<int64_t>(1, std::chrono::duration_cast<std::chrono::milliseconds>(netPeriod).count()));
+        }
+
+        const TickRates& tickRates() const { return rates; }
+        const TickStats& stats() const { return statistics; }
+        void resetStats()
+        {
+            statistics = TickStats();
+            wakes = 0;
+            steps = 0;
+        }
+
+    private:
+        static TickRates ratesAt(uint32_t simulationHz)
+        {
+            TickRates r;
+            r.simulationHz = simulationHz;
+            return r;
+        }
+
+        static Clock::duration periodOf(uint32_t hz)
+        {
+            return std::chrono::duration_cast<Clock::duration>(std::chrono::seconds(1)) / hz;
+        }
+
+        //Moves next past now in whole periods, keeping it on its grid. Returns how many periods were skipped.
+        static uint64_t skipMissed(Clock::time_point& next, Clock::duration period, Clock::time_point now)
+        {
+            if (now < next)
+            {
+                return 0;
+            }
+            uint64_t missed = static_cast<uint64_t>((now - next) / period) + 1;
+            next += period * static_cast<int64_t>(missed);
+            return missed;
+        }
+
+        static bool due(Clock::time_point& next, Clock::duration period, Clock::time_point now)
+        {
+            if (now < next)
+            {
+                return false;
+            }
+            skipMissed(next, period, now);
+            return true;
+        }
+
+        double alpha() const
+        {
+            double left = std::chrono::duration<double>(simNext - Clock::now()).count() / std::chrono::duration<double>(simPeriod).count();
+            return std::min(1.0, std::max(0.0, 1.0 - left));
+        }
+
+        void waitUntil(Clock::time_point deadline) const
+        {
+            const Clock::duration spin = std::chrono::microseconds(rates.spinUs);
+            Clock::time_point now = Clock::now();
+            if (deadline - now > spin)
+            {
+                std::this_thread::sleep_for(deadline - now - spin);
+            }
+
+            if (rates.spinUs == 0)
+            {
+                return;
+            }
+
+            while (Clock::now() < deadline)
+            {
+                std::this_thread::yield();
+            }
+        }
+
+        void recordWake(Clock::duration late)
+        {
+            double us = std::chrono::duration<double, std::micro>(late).count();
+            ++wakes;
+            statistics.meanWakeLateUs += (us - statistics.meanWakeLateUs) / wakes;
+            statistics.worstWakeLateUs = std::max(statistics.worstWakeLateUs, us);
+        }
+
+        void recordWork(Clock::duration work, uint32_t ran)
+        {
+            double ms = std::chrono::duration<double, std::milli>(work).count();
+            ++steps;
+            statistics.lastWorkMs = ms;
+            statistics.worstWorkMs = std::max(statistics.worstWorkMs, ms);
+            statistics.meanWorkMs += (ms - statistics.meanWorkMs) / steps;
+            statistics.totalWorkSeconds += ms / 1000.0;
+
+            double budgetMs = std::chrono::duration<double, std::milli>(simPeriod).count();
+            if (ms > budgetMs)
+            {
+                ++statistics.overruns;
+                if (overrunCallback)
+                {
+                    TickOverrun o;
+                    //simulationTicks is a count, the last one run is one below it.
+                    o.simulationTick = statistics.simulationTicks ? statistics.simulationTicks - 1 : 0;
+                    o.simulationTicks = ran;
+                    o.workMs = ms;
+                    o.budgetMs = budgetMs;
+                    overrunCallback(o);
+                }
+            }
+        }
+
+        TickRates rates;
+        Clock::duration simPeriod;
+        Clock::duration netPeriod;
+        Clock::duration renderPeriod;
+        Clock::time_point simNext;
+        Clock::time_point netNext;
+        Clock::time_point renderNext;
+        bool started = false;
+
+        TickStats statistics;
+        uint64_t wakes = 0;
+        uint64_t steps = 0;
+        OverrunFn overrunCallback;
     };
 }
@@ -6,7 +6,6 @@
 #include <vector>
 #include <cstdlib>
 #include <ctime>
-#include <fstream>
 #include <string>
 
 int main() 
@@ -36,46 +35,49 @@ int main()
     }
     else 
     {
-        std::vector<uint16_t> knownServers;
-
-        //Reading available server ports from file
-        std::ifstream in("servers.txt");
-
-        uint16_t port;
-        while (in >> port) 
-        {
-            knownServers.push_back(port);
-        }
-        in.close();
+        //Asking the LAN which servers are up.
+        SimpleNet::Net::Initialize();
+        SimpleNet::LanDiscovery discovery;
+        std::vector<SimpleNet::ServerInfo> knownServers = discovery.discover(300);
 
         //If no servers, exit out of program.
         if (knownServers.empty()) 
         {
             std::cout << "No available servers found. Exiting.\n";
+            SimpleNet::Net::Deinitialize();
             return 0;
         }
 
-        //Show available servers.
+        //Pinging everything that answered and joining the best one.
+        SimpleNet::ServerBrowser browser;
+        browser.addCandidates(knownServers);
+        std::vector<SimpleNet::BrowseResult> ranked = browser.rank(400);
+        SimpleNet::Net::Deinitialize();
+
         std::cout << "Available servers:\n";
-        for (size_t i = 0; i < knownServers.size(); ++i) 
+        for (size_t i = 0; i < ranked.size(); ++i) 
         {
-            std::cout << i + 1 << ". Port " << knownServers[i] << "\n";
+            char ip[64] = "?";
+            enet_address_get_host_ip(&ranked[i].info.address, ip, sizeof(ip));
+            std::cout << i + 1 << ". " << ip << " port " << ranked[i].info.address.port;
+            if (ranked[i].reachable)
+            {
+                std::cout << " (" << ranked[i].info.playerCount << "/" << ranked[i].info.maxPlayers << " players, "
+                          << ranked[i].rttMs << " ms, " << static_cast<int>(ranked[i].loss * 100.0f) << "% loss)\n";
+            }
+            else
+            {
+                std::cout << " (no ping reply)\n";
+            }
         }
 
-        int choice;
-        //get choice
-        std::cout << "Choose a server to connect to (1-" << knownServers.size() << "): ";
-        std::cin >> choice;
-
-        //If the choice doesn't exist, exit out of game.
-        if (choice < 1 || choice >(int)knownServers.size()) 
-        {
-            std::cout << "Invalid choice. Exiting.\n";
-            return 0;
-        }
+        //The list is sorted best first. Even if nobody answered the pings, the server did answer discovery.
+        const SimpleNet::ServerInfo& chosen = ranked.front().info;
+        char chosenHost[64] = "localhost";
+        enet_address_get_host_ip(&chosen.address, chosenHost, sizeof(chosenHost));
+        std::cout << "Joining " << chosenHost << " port " << chosen.address.port << "\n";
 
-        uint16_t chosenPort = knownServers[choice - 1];
-        Game game(false, chosenPort);
+        Game game(false, chosen.address.port, chosenHost);
         game.run();
     }
 
@@ -0,0 +1,44 @@
+/**
+ @file  batched.h
+ @brief Controls for the batched Linux socket backend (src/unix_batched.c)
+*/
+#ifndef __ENET_BATCHED_H__
+#define __ENET_BATCHED_H__
+
+#include "enet/enet.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** Totals for every datagram socket going through the backend, batched or not. */
+typedef struct _ENetSocketBatchStats
+{
+   unsigned long long datagramsSent;
+   unsigned long long sendCalls;        /**< sendmsg/sendmmsg syscalls */
+   unsigned long long datagramsReceived;
+   unsigned long long receiveCalls;     /**< recvmsg/recvmmsg syscalls that returned data */
+   unsigned long long sendErrors;       /**< Datagrams the kernel refused when a batch went out */
+} ENetSocketBatchStats;
+
+/** Batches sends and receives on a datagram socket (an ENetHost's). Sends are queued and go out together
+    with sendmmsg on the next receive, wait, enet_socket_batch_flush or when the batch is full.
+    Receives are read up to a batch at a time with recvmmsg. Returns 0, or -1 if the socket can't be batched. */
+ENET_API int  enet_socket_batch_enable (ENetSocket);
+
+/** Sends everything queued on the socket. */
+ENET_API void enet_socket_batch_flush (ENetSocket);
+
+/** Datagrams already read from the kernel that enet_socket_receive has not handed out yet. A poll/epoll
+    loop has to service the host before waiting while this is non-zero. */
+ENET_API size_t enet_socket_batch_pending (ENetSocket);
+
+ENET_API void enet_socket_batch_stats (ENetSocketBatchStats *);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __ENET_BATCHED_H__ */
+
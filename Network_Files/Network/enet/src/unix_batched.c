@@ -0,0 +1,791 @@
+/**
+ @file  unix_batched.c
+ @brief ENet Unix system specific functions, with batched datagram I/O for Linux
+
+ Drop-in replacement for ENet 1.3.18's unix.c. Build ENet with this file instead of unix.c and define
+ SIMPLENET_ENET_BATCHING for SimpleNet.h. Sockets behave exactly like unix.c's until
+ enet_socket_batch_enable is called on them; SimpleNet does that for its host sockets.
+
+ A batched socket queues what ENet sends and hands the queue to the kernel with one sendmmsg, which
+ happens when ENet next receives or waits (enet_host_service sends to every peer, then receives), when
+ the batch is full, or on enet_socket_batch_flush. Receives read up to ENET_BATCH_SIZE datagrams with one
+ recvmmsg and hand them out one per enet_socket_receive call.
+
+ Errors on queued sends can't be returned to the sendmsg caller any more, they are counted in
+ ENetSocketBatchStats::sendErrors. For ENet that is the same as a lost datagram.
+*/
+#ifndef __linux__
+#error "unix_batched.c needs sendmmsg/recvmmsg (Linux), build ENet with unix.c or win32.c elsewhere"
+#endif
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <sys/time.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <poll.h>
+
+#define ENET_BUILDING_LIB 1
+#include "enet/enet.h"
+#include "enet/batched.h"
+
+#define ENET_BATCH_SIZE 32
+#define ENET_BATCH_MAX_SOCKETS 4096
+
+typedef struct _ENetBatchQueue
+{
+   struct mmsghdr messages [ENET_BATCH_SIZE];
+   struct iovec iov [ENET_BATCH_SIZE];
+   struct sockaddr_in addresses [ENET_BATCH_SIZE];
+   enet_uint8 data [ENET_BATCH_SIZE][ENET_PROTOCOL_MAXIMUM_MTU];
+   size_t count;
+   size_t next;
+} ENetBatchQueue;
+
+typedef struct _ENetSocketBatch
+{
+   ENetBatchQueue send;
+   ENetBatchQueue receive;
+} ENetSocketBatch;
+
+/* Indexed by fd. A socket is only ever used by the thread servicing its host, so a slot has one user at a time. */
+static ENetSocketBatch * batches [ENET_BATCH_MAX_SOCKETS];
+
+static ENetSocketBatchStats batchStats;
+
+static enet_uint32 timeBase = 0;
+
+#define ENET_BATCH_COUNT(field, amount) __atomic_fetch_add (& batchStats.field, (unsigned long long) (amount), __ATOMIC_RELAXED)
+
+static ENetSocketBatch *
+enet_socket_batch_get (ENetSocket socket)
+{
+    if (socket < 0 || socket >= ENET_BATCH_MAX_SOCKETS)
+      return NULL;
+
+    return __atomic_load_n (& batches [socket], __ATOMIC_ACQUIRE);
+}
+
+int
+enet_initialize (void)
+{
+    return 0;
+}
+
+void
+enet_deinitialize (void)
+{
+}
+
+enet_uint32
+enet_host_random_seed (void)
+{
+    return (enet_uint32) time (NULL);
+}
+
+enet_uint32
+enet_time_get (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, & ts);
+
+    return (enet_uint32) (ts.tv_sec * 1000 + ts.tv_nsec / 1000000) - timeBase;
+}
+
+void
+enet_time_set (enet_uint32 newTimeBase)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, & ts);
+
+    timeBase = (enet_uint32) (ts.tv_sec * 1000 + ts.tv_nsec / 1000000) - newTimeBase;
+}
+
+int
+enet_address_set_host_ip (ENetAddress * address, const char * name)
+{
+    if (! inet_pton (AF_INET, name, & address -> host))
+      return -1;
+
+    return 0;
+}
+
+int
+enet_address_set_host (ENetAddress * address, const char * name)
+{
+    struct addrinfo hints, * resultList = NULL, * result = NULL;
+
+    memset (& hints, 0, sizeof (hints));
+    hints.ai_family = AF_INET;
+
+    if (getaddrinfo (name, NULL, & hints, & resultList) != 0)
+      return -1;
+
+    for (result = resultList; result != NULL; result = result -> ai_next)
+    {
+        if (result -> ai_family == AF_INET && result -> ai_addr != NULL && result -> ai_addrlen >= sizeof (struct sockaddr_in))
+        {
+            struct sockaddr_in * sin = (struct sockaddr_in *) result -> ai_addr;
+
+            address -> host = sin -> sin_addr.s_addr;
+
+            freeaddrinfo (resultList);
+
+            return 0;
+        }
+    }
+
+    if (resultList != NULL)
+      freeaddrinfo (resultList);
+
+    return enet_address_set_host_ip (address, name);
+}
+
+int
+enet_address_get_host_ip (const ENetAddress * address, char * name, size_t nameLength)
+{
+    if (inet_ntop (AF_INET, & address -> host, name, nameLength) == NULL)
+      return -1;
+
+    return 0;
+}
+
+int
+enet_address_get_host (const ENetAddress * address, char * name, size_t nameLength)
+{
+    struct sockaddr_in sin;
+    int err;
+
+    memset (& sin, 0, sizeof (struct sockaddr_in));
+
+    sin.sin_family = AF_INET;
+    sin.sin_port = ENET_HOST_TO_NET_16 (address -> port);
+    sin.sin_addr.s_addr = address -> host;
+
+    err = getnameinfo ((struct sockaddr *) & sin, sizeof (sin), name, nameLength, NULL, 0, NI_NAMEREQD);
+    if (! err)
+    {
+        if (name != NULL && nameLength > 0 && ! memchr (name, '\0', nameLength))
+          return -1;
+        return 0;
+    }
+    if (err != EAI_NONAME)
+      return -1;
+
+    return enet_address_get_host_ip (address, name, nameLength);
+}
+
+int
+enet_socket_bind (ENetSocket socket, const ENetAddress * address)
+{
+    struct sockaddr_in sin;
+
+    memset (& sin, 0, sizeof (struct sockaddr_in));
+
+    sin.sin_family = AF_INET;
+
+    if (address != NULL)
+    {
+       sin.sin_port = ENET_HOST_TO_NET_16 (address -> port);
+       sin.sin_addr.s_addr = address -> host;
+    }
+    else
+    {
+       sin.sin_port = 0;
+       sin.sin_addr.s_addr = INADDR_ANY;
+    }
+
+    return bind (socket,
+                 (struct sockaddr *) & sin,
+                 sizeof (struct sockaddr_in));
+}
+
+int
+enet_socket_get_address (ENetSocket socket, ENetAddress * address)
+{
+    struct sockaddr_in sin;
+    socklen_t sinLength = sizeof (struct sockaddr_in);
+
+    if (getsockname (socket, (struct sockaddr *) & sin, & sinLength) == -1)
+      return -1;
+
+    address -> host = (enet_uint32) sin.sin_addr.s_addr;
+    address -> port = ENET_NET_TO_HOST_16 (sin.sin_port);
+
+    return 0;
+}
+
+int
+enet_socket_listen (ENetSocket socket, int backlog)
+{
+    return listen (socket, backlog < 0 ? SOMAXCONN : backlog);
+}
+
+ENetSocket
+enet_socket_create (ENetSocketType type)
+{
+    return socket (PF_INET, type == ENET_SOCKET_TYPE_DATAGRAM ? SOCK_DGRAM : SOCK_STREAM, 0);
+}
+
+int
+enet_socket_set_option (ENetSocket socket, ENetSocketOption option, int value)
+{
+    int result = -1;
+    switch (option)
+    {
+        case ENET_SOCKOPT_NONBLOCK:
+            result = fcntl (socket, F_SETFL, (value ? O_NONBLOCK : 0) | (fcntl (socket, F_GETFL) & ~O_NONBLOCK));
+            break;
+
+        case ENET_SOCKOPT_BROADCAST:
+            result = setsockopt (socket, SOL_SOCKET, SO_BROADCAST, (char *) & value, sizeof (int));
+            break;
+
+        case ENET_SOCKOPT_REUSEADDR:
+            result = setsockopt (socket, SOL_SOCKET, SO_REUSEADDR, (char *) & value, sizeof (int));
+            break;
+
+        case ENET_SOCKOPT_RCVBUF:
+            result = setsockopt (socket, SOL_SOCKET, SO_RCVBUF, (char *) & value, sizeof (int));
+            break;
+
+        case ENET_SOCKOPT_SNDBUF:
+            result = setsockopt (socket, SOL_SOCKET, SO_SNDBUF, (char *) & value, sizeof (int));
+            break;
+
+        case ENET_SOCKOPT_RCVTIMEO:
+        {
+            struct timeval timeVal;
+            timeVal.tv_sec = value / 1000;
+            timeVal.tv_usec = (value % 1000) * 1000;
+            result = setsockopt (socket, SOL_SOCKET, SO_RCVTIMEO, (char *) & timeVal, sizeof (struct timeval));
+            break;
+        }
+
+        case ENET_SOCKOPT_SNDTIMEO:
+        {
+            struct timeval timeVal;
+            timeVal.tv_sec = value / 1000;
+            timeVal.tv_usec = (value % 1000) * 1000;
+            result = setsockopt (socket, SOL_SOCKET, SO_SNDTIMEO, (char *) & timeVal, sizeof (struct timeval));
+            break;
+        }
+
+        case ENET_SOCKOPT_NODELAY:
+            result = setsockopt (socket, IPPROTO_TCP, TCP_NODELAY, (char *) & value, sizeof (int));
+            break;
+
+        case ENET_SOCKOPT_TTL:
+            result = setsockopt (socket, IPPROTO_IP, IP_TTL, (char *) & value, sizeof (int));
+            break;
+
+        default:
+            break;
+    }
+    return result == -1 ? -1 : 0;
+}
+
+int
+enet_socket_get_option (ENetSocket socket, ENetSocketOption option, int * value)
+{
+    int result = -1;
+    socklen_t len;
+    switch (option)
+    {
+        case ENET_SOCKOPT_ERROR:
+            len = sizeof (int);
+            result = getsockopt (socket, SOL_SOCKET, SO_ERROR, value, & len);
+            break;
+
+        case ENET_SOCKOPT_TTL:
+            len = sizeof (int);
+            result = getsockopt (socket, IPPROTO_IP, IP_TTL, (char *) value, & len);
+            break;
+
+        default:
+            break;
+    }
+    return result == -1 ? -1 : 0;
+}
+
+int
+enet_socket_connect (ENetSocket socket, const ENetAddress * address)
+{
+    struct sockaddr_in sin;
+    int result;
+
+    memset (& sin, 0, sizeof (struct sockaddr_in));
+
+    sin.sin_family = AF_INET;
+    sin.sin_port = ENET_HOST_TO_NET_16 (address -> port);
+    sin.sin_addr.s_addr = address -> host;
+
+    result = connect (socket, (struct sockaddr *) & sin, sizeof (struct sockaddr_in));
+    if (result == -1 && errno == EINPROGRESS)
+      return 0;
+
+    return result;
+}
+
+ENetSocket
+enet_socket_accept (ENetSocket socket, ENetAddress * address)
+{
+    int result;
+    struct sockaddr_in sin;
+    socklen_t sinLength = sizeof (struct sockaddr_in);
+
+    result = accept (socket,
+                     address != NULL ? (struct sockaddr *) & sin : NULL,
+                     address != NULL ? & sinLength : NULL);
+
+    if (result == -1)
+      return ENET_SOCKET_NULL;
+
+    if (address != NULL)
+    {
+        address -> host = (enet_uint32) sin.sin_addr.s_addr;
+        address -> port = ENET_NET_TO_HOST_16 (sin.sin_port);
+    }
+
+    return result;
+}
+
+int
+enet_socket_shutdown (ENetSocket socket, ENetSocketShutdown how)
+{
+    return shutdown (socket, (int) how);
+}
+
+int
+enet_socket_batch_enable (ENetSocket socket)
+{
+    ENetSocketBatch * batch;
+
+    if (socket < 0 || socket >= ENET_BATCH_MAX_SOCKETS)
+      return -1;
+
+    if (enet_socket_batch_get (socket) != NULL)
+      return 0;
+
+    batch = (ENetSocketBatch *) enet_malloc (sizeof (ENetSocketBatch));
+    if (batch == NULL)
+      return -1;
+
+    memset (batch, 0, sizeof (ENetSocketBatch));
+
+    __atomic_store_n (& batches [socket], batch, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+void
+enet_socket_batch_flush (ENetSocket socket)
+{
+    ENetSocketBatch * batch = enet_socket_batch_get (socket);
+    ENetBatchQueue * queue;
+    size_t next = 0;
+
+    if (batch == NULL || batch -> send.count == 0)
+      return;
+
+    queue = & batch -> send;
+
+    while (next < queue -> count)
+    {
+       int result = sendmmsg (socket, & queue -> messages [next], (unsigned int) (queue -> count - next), MSG_NOSIGNAL);
+       size_t accepted = result > 0 ? (size_t) result : 0;
+
+       ENET_BATCH_COUNT (sendCalls, 1);
+       ENET_BATCH_COUNT (datagramsSent, accepted);
+
+       next += accepted;
+       if (result == -1 && errno == EWOULDBLOCK)
+       {
+          /* Socket buffer is full, the rest would fail the same way. */
+          ENET_BATCH_COUNT (sendErrors, queue -> count - next);
+          break;
+       }
+       if (next < queue -> count)
+       {
+          /* sendmmsg stops at the first datagram the kernel refuses, that one is dropped like a lost datagram. */
+          ENET_BATCH_COUNT (sendErrors, 1);
+          ++ next;
+       }
+    }
+
+    queue -> count = 0;
+}
+
+size_t
+enet_socket_batch_pending (ENetSocket socket)
+{
+    ENetSocketBatch * batch = enet_socket_batch_get (socket);
+
+    if (batch == NULL)
+      return 0;
+
+    return batch -> receive.count - batch -> receive.next;
+}
+
+void
+enet_socket_batch_stats (ENetSocketBatchStats * stats)
+{
+    stats -> datagramsSent = __atomic_load_n (& batchStats.datagramsSent, __ATOMIC_RELAXED);
+    stats -> sendCalls = __atomic_load_n (& batchStats.sendCalls, __ATOMIC_RELAXED);
+    stats -> datagramsReceived = __atomic_load_n (& batchStats.datagramsReceived, __ATOMIC_RELAXED);
+    stats -> receiveCalls = __atomic_load_n (& batchStats.receiveCalls, __ATOMIC_RELAXED);
+    stats -> sendErrors = __atomic_load_n (& batchStats.sendErrors, __ATOMIC_RELAXED);
+}
+
+void
+enet_socket_destroy (ENetSocket socket)
+{
+    ENetSocketBatch * batch;
+
+    if (socket == -1)
+      return;
+
+    batch = enet_socket_batch_get (socket);
+    if (batch != NULL)
+    {
+       enet_socket_batch_flush (socket);
+
+       __atomic_store_n (& batches [socket], NULL, __ATOMIC_RELEASE);
+
+       enet_free (batch);
+    }
+
+    close (socket);
+}
+
+static int
+enet_socket_batch_send (ENetSocket socket, ENetSocketBatch * batch, const ENetAddress * address, const ENetBuffer * buffers, size_t bufferCount)
+{
+    ENetBatchQueue * queue = & batch -> send;
+    size_t length = 0, i;
+    enet_uint8 * data;
+
+    for (i = 0; i < bufferCount; ++ i)
+      length += buffers [i].dataLength;
+
+    if (length > ENET_PROTOCOL_MAXIMUM_MTU)
+      return -2;
+
+    if (queue -> count == ENET_BATCH_SIZE)
+      enet_socket_batch_flush (socket);
+
+    data = queue -> data [queue -> count];
+    for (i = 0; i < bufferCount; ++ i)
+    {
+       memcpy (data, buffers [i].data, buffers [i].dataLength);
+       data += buffers [i].dataLength;
+    }
+
+    memset (& queue -> addresses [queue -> count], 0, sizeof (struct sockaddr_in));
+    queue -> addresses [queue -> count].sin_family = AF_INET;
+    queue -> addresses [queue -> count].sin_port = ENET_HOST_TO_NET_16 (address -> port);
+    queue -> addresses [queue -> count].sin_addr.s_addr = address -> host;
+
+    queue -> iov [queue -> count].iov_base = queue -> data [queue -> count];
+    queue -> iov [queue -> count].iov_len = length;
+
+    memset (& queue -> messages [queue -> count], 0, sizeof (struct mmsghdr));
+    queue -> messages [queue -> count].msg_hdr.msg_name = & queue -> addresses [queue -> count];
+    queue -> messages [queue -> count].msg_hdr.msg_namelen = sizeof (struct sockaddr_in);
+    queue -> messages [queue -> count].msg_hdr.msg_iov = & queue -> iov [queue -> count];
+    queue -> messages [queue -> count].msg_hdr.msg_iovlen = 1;
+
+    ++ queue -> count;
+
+    return (int) length;
+}
+
+int
+enet_socket_send (ENetSocket socket,
+                  const ENetAddress * address,
+                  const ENetBuffer * buffers,
+                  size_t bufferCount)
+{
+    ENetSocketBatch * batch = enet_socket_batch_get (socket);
+    struct msghdr msgHdr;
+    struct sockaddr_in sin;
+    int sentLength;
+
+    if (batch != NULL)
+    {
+       /* Connected sends and anything too big to queue go straight out, after what is already queued. */
+       if (address != NULL)
+       {
+          sentLength = enet_socket_batch_send (socket, batch, address, buffers, bufferCount);
+          if (sentLength != -2)
+            return sentLength;
+       }
+
+       enet_socket_batch_flush (socket);
+    }
+
+    memset (& msgHdr, 0, sizeof (struct msghdr));
+
+    if (address != NULL)
+    {
+        memset (& sin, 0, sizeof (struct sockaddr_in));
+
+        sin.sin_family = AF_INET;
+        sin.sin_port = ENET_HOST_TO_NET_16 (address -> port);
+        sin.sin_addr.s_addr = address -> host;
+
+        msgHdr.msg_name = & sin;
+        msgHdr.msg_namelen = sizeof (struct sockaddr_in);
+    }
+
+    msgHdr.msg_iov = (struct iovec *) buffers;
+    msgHdr.msg_iovlen = bufferCount;
+
+    sentLength = sendmsg (socket, & msgHdr, MSG_NOSIGNAL);
+
+    ENET_BATCH_COUNT (sendCalls, 1);
+
+    if (sentLength == -1)
+    {
+       if (errno == EWOULDBLOCK)
+         return 0;
+
+       return -1;
+    }
+
+    ENET_BATCH_COUNT (datagramsSent, 1);
+
+    return sentLength;
+}
+
+/* Refills the receive batch with one recvmmsg. Returns how many datagrams came in, 0 if none, -1 on error. */
+static int
+enet_socket_batch_fill (ENetSocket socket, ENetBatchQueue * queue)
+{
+    int result;
+    size_t i;
+
+    for (i = 0; i < ENET_BATCH_SIZE; ++ i)
+    {
+       queue -> iov [i].iov_base = queue -> data [i];
+       queue -> iov [i].iov_len = ENET_PROTOCOL_MAXIMUM_MTU;
+
+       memset (& queue -> messages [i], 0, sizeof (struct mmsghdr));
+       queue -> messages [i].msg_hdr.msg_name = & queue -> addresses [i];
+       queue -> messages [i].msg_hdr.msg_namelen = sizeof (struct sockaddr_in);
+       queue -> messages [i].msg_hdr.msg_iov = & queue -> iov [i];
+       queue -> messages [i].msg_hdr.msg_iovlen = 1;
+    }
+
+    queue -> count = 0;
+    queue -> next = 0;
+
+    result = recvmmsg (socket, queue -> messages, ENET_BATCH_SIZE, MSG_DONTWAIT, NULL);
+    if (result == -1)
+    {
+       if (errno == EWOULDBLOCK)
+         return 0;
+
+       return -1;
+    }
+
+    if (result > 0)
+    {
+       ENET_BATCH_COUNT (receiveCalls, 1);
+       ENET_BATCH_COUNT (datagramsReceived, result);
+    }
+
+    queue -> count = (size_t) result;
+
+    return result;
+}
+
+static int
+enet_socket_batch_receive (ENetSocket socket, ENetSocketBatch * batch, ENetAddress * address, ENetBuffer * buffers, size_t bufferCount)
+{
+    ENetBatchQueue * queue = & batch -> receive;
+
+    /* Replies to what ENet just sent go out before it looks for more. */
+    enet_socket_batch_flush (socket);
+
+    for (;;)
+    {
+       struct mmsghdr * message;
+       size_t length, copied = 0, i;
+
+       if (queue -> next == queue -> count)
+       {
+          int result = enet_socket_batch_fill (socket, queue);
+          if (result <= 0)
+            return result;
+       }
+
+       message = & queue -> messages [queue -> next];
+       length = message -> msg_len;
+
+       if (message -> msg_hdr.msg_flags & MSG_TRUNC)
+       {
+          ++ queue -> next;
+          continue;
+       }
+
+       for (i = 0; i < bufferCount && copied < length; ++ i)
+       {
+          size_t part = length - copied;
+          if (part > buffers [i].dataLength)
+            part = buffers [i].dataLength;
+
+          memcpy (buffers [i].data, queue -> data [queue -> next] + copied, part);
+          copied += part;
+       }
+
+       if (address != NULL)
+       {
+          address -> host = (enet_uint32) queue -> addresses [queue -> next].sin_addr.s_addr;
+          address -> port = ENET_NET_TO_HOST_16 (queue -> addresses [queue -> next].sin_port);
+       }
+
+       ++ queue -> next;
+
+       /* Didn't fit in ENet's buffer, same as a truncated datagram. */
+       if (copied < length)
+         continue;
+
+       return (int) length;
+    }
+}
+
+int
+enet_socket_receive (ENetSocket socket,
+                     ENetAddress * address,
+                     ENetBuffer * buffers,
+                     size_t bufferCount)
+{
+    ENetSocketBatch * batch = enet_socket_batch_get (socket);
+    struct msghdr msgHdr;
+    struct sockaddr_in sin;
+    int recvLength;
+
+    if (batch != NULL)
+      return enet_socket_batch_receive (socket, batch, address, buffers, bufferCount);
+
+    for (;;)
+    {
+       memset (& msgHdr, 0, sizeof (struct msghdr));
+
+       if (address != NULL)
+       {
+           msgHdr.msg_name = & sin;
+           msgHdr.msg_namelen = sizeof (struct sockaddr_in);
+       }
+
+       msgHdr.msg_iov = (struct iovec *) buffers;
+       msgHdr.msg_iovlen = bufferCount;
+
+       recvLength = recvmsg (socket, & msgHdr, MSG_NOSIGNAL);
+
+       if (recvLength == -1)
+       {
+          if (errno == EWOULDBLOCK)
+            return 0;
+
+          return -1;
+       }
+
+       ENET_BATCH_COUNT (receiveCalls, 1);
+       ENET_BATCH_COUNT (datagramsReceived, 1);
+
+       /* Truncated datagrams aren't ENet's, skip to the next one. */
+       if (! (msgHdr.msg_flags & MSG_TRUNC))
+         break;
+    }
+
+    if (address != NULL)
+    {
+        address -> host = (enet_uint32) sin.sin_addr.s_addr;
+        address -> port = ENET_NET_TO_HOST_16 (sin.sin_port);
+    }
+
+    return recvLength;
+}
+
+int
+enet_socketset_select (ENetSocket maxSocket, ENetSocketSet * readSet, ENetSocketSet * writeSet, enet_uint32 timeout)
+{
+    struct timeval timeVal;
+
+    timeVal.tv_sec = timeout / 1000;
+    timeVal.tv_usec = (timeout % 1000) * 1000;
+
+    return select (maxSocket + 1, readSet, writeSet, NULL, & timeVal);
+}
+
+int
+enet_socket_wait (ENetSocket socket, enet_uint32 * condition, enet_uint32 timeout)
+{
+    struct pollfd pollSocket;
+    int pollCount;
+
+    if (enet_socket_batch_get (socket) != NULL)
+    {
+       enet_socket_batch_flush (socket);
+
+       /* Already read from the kernel, poll would not see it. */
+       if ((* condition & ENET_SOCKET_WAIT_RECEIVE) && enet_socket_batch_pending (socket) > 0)
+       {
+          * condition = ENET_SOCKET_WAIT_RECEIVE;
+          return 0;
+       }
+    }
+
+    pollSocket.fd = socket;
+    pollSocket.events = 0;
+
+    if (* condition & ENET_SOCKET_WAIT_SEND)
+      pollSocket.events |= POLLOUT;
+
+    if (* condition & ENET_SOCKET_WAIT_RECEIVE)
+      pollSocket.events |= POLLIN;
+
+    pollCount = poll (& pollSocket, 1, timeout);
+
+    if (pollCount < 0)
+    {
+        if (errno == EINTR && * condition & ENET_SOCKET_WAIT_INTERRUPT)
+        {
+            * condition = ENET_SOCKET_WAIT_INTERRUPT;
+
+            return 0;
+        }
+
+        return -1;
+    }
+
+    * condition = ENET_SOCKET_WAIT_NONE;
+
+    if (pollCount == 0)
+      return 0;
+
+    if (pollSocket.revents & POLLOUT)
+      * condition |= ENET_SOCKET_WAIT_SEND;
+
+    if (pollSocket.revents & POLLIN)
+      * condition |= ENET_SOCKET_WAIT_RECEIVE;
+
+    return 0;
+}
+
@@ -0,0 +1,532 @@
+// BotLoadGen: drives one game server with many simulated players from a single process.
+//
+// Every bot is a NetClient with its own ENet host, so to the server it looks exactly like a game
+// client on its own port. Bots connect at --ramp per second, then move on a scripted path and send
+// their position --input-rate times a second on the Movement channel, the same way Game does.
+//
+// Reported at the end (and as JSON with --out):
+//  - rtt:      ENet's round trip time per bot, sampled once a second
+//  - loss:     ENet's reliable packet loss estimate per bot, sampled once a second
+//  - response: time from a bot sending a position until the server broadcasts it back. Includes
+//              the server's tick, so it is what a player would feel as input delay
+//  - connect:  time from connectAsync to Connect, plus failures and drops
+//
+// Between input ticks the tool waits on every bot's socket with one poll() call (see
+// NetClient::socketHandle/nextTimeoutMs/processReadable), so replies are timed when they arrive
+// rather than at the next tick.
+//
+// Point it at a DedicatedServer to find how many players a tick rate and machine can carry.
+//
+// Usage: BotLoadGen [--host H] [--port P] [--bots N] [--seconds S] [--input-rate HZ]
+//                   [--ramp BOTS_PER_SEC] [--movement wander|circle|still] [--out FILE]
+
+#include "SimpleNet.h"
+#include "../../MultiplayerTestGame/GameProtocol.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+using PollFd = WSAPOLLFD;
+static int pollSockets(PollFd* fds, size_t count, int timeoutMs) { return WSAPoll(fds, static_cast<ULONG>(count), timeoutMs); }
+#else
+#include <poll.h>
+using PollFd = pollfd;
+static int pollSockets(PollFd* fds, size_t count, int timeoutMs) { return poll(fds, static_cast<nfds_t>(count), timeoutMs); }
+#endif
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    enum class Movement
+    {
+        Wander,  //Walks to random points in the world
+        Circle,  //Circles its spawn point
+        Still    //Sends the same position, the server still relays it
+    };
+
+    struct Options
+    {
+        std::string host = "127.0.0.1";
+        uint16_t port = 7777;
+        uint32_t bots = 100;
+        double seconds = 30.0;
+        uint32_t inputRate = TICK_RATE;
+        uint32_t ramp = 50;
+        Movement movement = Movement::Wander;
+        std::string outPath;
+    };
+
+    bool parseArgs(int argc, char** argv, Options& opt)
+    {
+        for (int i = 1; i < argc; ++i)
+        {
+            std::string a = argv[i];
+            bool hasValue = i + 1 < argc;
+
+            if (a == "--host" && hasValue) opt.host = argv[++i];
+            else if (a == "--port" && hasValue) opt.port = static_cast<uint16_t>(std::atoi(argv[++i]));
+            else if (a == "--bots" && hasValue) opt.bots = static_cast<uint32_t>(std::atoi(argv[++i]));
+            else if (a == "--seconds" && hasValue) opt.seconds = std::atof(argv[++i]);
+            else if (a == "--input-rate" && hasValue) opt.inputRate = static_cast<uint32_t>(std::atoi(argv[++i]));
+            else if (a == "--ramp" && hasValue) opt.ramp = static_cast<uint32_t>(std::atoi(argv[++i]));
+            else if (a == "--out" && hasValue) opt.outPath = argv[++i];
+            else if (a == "--movement" && hasValue)
+            {
+                std::string m = argv[++i];
+                if (m == "wander") opt.movement = Movement::Wander;
+                else if (m == "circle") opt.movement = Movement::Circle;
+                else if (m == "still") opt.movement = Movement::Still;
+                else
+                {
+                    std::cerr << "Unknown movement " << m << "\n";
+                    return false;
+                }
+            }
+            else
+            {
+                std::cerr << "Usage: BotLoadGen [--host H] [--port P] [--bots N] [--seconds S] [--input-rate HZ] [--ramp BOTS_PER_SEC] [--movement wander|circle|still] [--out FILE]\n";
+                return false;
+            }
+        }
+
+        if (opt.bots == 0 || opt.inputRate == 0 || opt.inputRate > 1000 || opt.ramp == 0)
+        {
+            std::cerr << "--bots and --ramp must be at least 1, --input-rate 1-1000\n";
+            return false;
+        }
+        return true;
+    }
+
+    struct Summary
+    {
+        size_t count = 0;
+        double mean = 0, p50 = 0, p90 = 0, p99 = 0, p999 = 0, max = 0;
+    };
+
+    Summary summarize(std::vector<double> v)
+    {
+        Summary s;
+        s.count = v.size();
+        if (v.empty())
+        {
+            return s;
+        }
+
+        std::sort(v.begin(), v.end());
+        double total = 0;
+        for (double x : v) total += x;
+
+        auto pct = [&](double p)
+        {
+            size_t idx = static_cast<size_t>(p * (v.size() - 1) + 0.5);
+            return v[std::min(idx, v.size() - 1)];
+        };
+
+        s.mean = total / v.size();
+        s.p50 = pct(0.50);
+        s.p90 = pct(0.90);
+        s.p99 = pct(0.99);
+        s.p999 = pct(0.999);
+        s.max = v.back();
+        return s;
+    }
+
+    std::string toJson(const Summary& s)
+    {
+        std::ostringstream o;
+        o << "{\"count\": " << s.count << ", \"mean\": " << s.mean << ", \"p50\": " << s.p50 << ", \"p90\": " << s.p90
+          << ", \"p99\": " << s.p99 << ", \"p999\": " << s.p999 << ", \"max\": " << s.max << "}";
+        return o.str();
+    }
+
+    //Samples from every bot, in milliseconds (loss as a percentage).
+    struct Totals
+    {
+        std::vector<double> rtt;
+        std::vector<double> loss;
+        std::vector<double> response;
+        std::vector<double> connect;
+        uint64_t connectFailures = 0;
+        uint64_t drops = 0;
+        uint64_t positionsSent = 0;
+        uint64_t updatesReceived = 0;
+    };
+
+    class Bot
+    {
+    public:
+        enum class State { Idle, Connecting, Connected, Finished };
+
+        Bot(uint32_t seed, Movement movement) : rng(seed), movement(movement)
+        {
+            client.setChannelLayout(gameChannels());
+            spawnX = x = static_cast<float>(rng() % (WORLD_WIDTH - 40));
+            spawnY = y = static_cast<float>(rng() % (WORLD_HEIGHT - 40));
+            pickWaypoint();
+        }
+
+        bool start(const Options& opt)
+        {
+            connectStarted = Clock::now();
+            if (client.connectAsync(opt.host, opt.port) == 0)
+            {
+                state = State::Finished;
+                return false;
+            }
+            state = State::Connecting;
+            return true;
+        }
+
+        bool active() const { return state == State::Connecting || state == State::Connected; }
+        ENetSocket socket() const { return client.socketHandle(); }
+        uint32_t nextTimeoutMs(uint32_t maxMs) const { return client.nextTimeoutMs(maxMs); }
+
+        //Whatever the bot's socket has for it, without blocking.
+        void pump(Totals& totals)
+        {
+            if (!active())
+            {
+                return;
+            }
+
+            client.processReadable([&](const SimpleNet::NetEvent& e)
+            {
+                switch (e.type)
+                {
+                case SimpleNet::NetEvent::Connect:
+                {
+                    state = State::Connected;
+                    totals.connect.push_back(msSince(connectStarted));
+                    break;
+                }
+                case SimpleNet::NetEvent::ConnectFailed:
+                {
+                    state = State::Finished;
+                    ++totals.connectFailures;
+                    break;
+                }
+                case SimpleNet::NetEvent::Disconnect:
+                {
+                    state = State::Finished;
+                    ++totals.drops;
+                    break;
+                }
+                case SimpleNet::NetEvent::Receive:
+                {
+                    if (e.channel == static_cast<uint8_t>(GameChannel::Movement))
+                    {
+                        received(e.packet, totals);
+                    }
+                    break;
+                }
+                default:
+                {
+                    break;
+                }
+                }
+            });
+        }
+
+        //This tick's network events, then its input.
+        void tick(Totals& totals)
+        {
+            pump(totals);
+            if (state != State::Connected)
+            {
+                return;
+            }
+
+            step();
+            stateOut.set(0, PlayerPosition, NetPosition{ x, y });
+
+            SimpleNet::Packet packet;
+            if (stateOut.flush(packet, 1200) && client.send(packet, GameChannel::Movement) == SimpleNet::SendResult::Ok)
+            {
+                ++totals.positionsSent;
+                sentPositions.push_back(Sent{ x, y, Clock::now() });
+                if (sentPositions.size() > MaxTracked)
+                {
+                    sentPositions.pop_front();
+                }
+            }
+        }
+
+        void sampleLink(Totals& totals) const
+        {
+            SimpleNet::PeerStats stats;
+            if (state == State::Connected && client.peerStats(stats))
+            {
+                totals.rtt.push_back(stats.rttMs);
+                totals.loss.push_back(stats.packetLoss * 100.0);
+            }
+        }
+
+        void stop()
+        {
+            if (state == State::Connected)
+            {
+                client.disconnect();
+            }
+            client.service(0, [](const SimpleNet::NetEvent&) {});
+            state = State::Finished;
+        }
+
+        State current() const { return state; }
+
+    private:
+        //Positions sent but not yet seen coming back. Enough for a couple of seconds of input.
+        static constexpr size_t MaxTracked = 256;
+
+        struct Sent
+        {
+            float x, y;
+            Clock::time_point at;
+        };
+
+        static double msSince(Clock::time_point t)
+        {
+            return std::chrono::duration<double, std::milli>(Clock::now() - t).count();
+        }
+
+        //The server relays everyone's position, this bot's own included. The first update that matches a
+        //position it sent tells it which entity it is, after that only that entity is timed.
+        void received(const SimpleNet::Packet& packet, Totals& totals)
+        {
+            stateIn.apply(0, packet, [&](uint32_t entity, uint16_t property, SimpleNet::PacketReader& value)
+            {
+                NetPosition pos;
+                if (property != PlayerPosition || !value.readPOD(pos))
+                {
+                    return;
+                }
+                ++totals.updatesReceived;
+
+                if (knowsSelf && entity != selfId)
+                {
+                    return;
+                }
+
+                for (auto it = sentPositions.begin(); it != sentPositions.end(); ++it)
+                {
+                    if (it->x == pos.x && it->y == pos.y)
+                    {
+                        totals.response.push_back(msSince(it->at));
+                        sentPositions.erase(sentPositions.begin(), it + 1);
+                        selfId = entity;
+                        knowsSelf = true;
+                        break;
+                    }
+                }
+            });
+        }
+
+        void pickWaypoint()
+        {
+            targetX = static_cast<float>(rng() % (WORLD_WIDTH - 40));
+            targetY = static_cast<float>(rng() % (WORLD_HEIGHT - 40));
+        }
+
+        //Same speed as a player holding a key in the game.
+        void step()
+        {
+            const float speed = 2.0f;
+
+            switch (movement)
+            {
+            case Movement::Wander:
+            {
+                float dx = targetX - x;
+                float dy = targetY - y;
+                float distance = std::sqrt(dx * dx + dy * dy);
+                if (distance <= speed)
+                {
+                    x = targetX;
+                    y = targetY;
+                    pickWaypoint();
+                }
+                else
+                {
+                    x += dx / distance * speed;
+                    y += dy / distance * speed;
+                }
+                break;
+            }
+            case Movement::Circle:
+            {
+                angle += speed / 50.0f;
+                x = spawnX + std::cos(angle) * 50.0f;
+                y = spawnY + std::sin(angle) * 50.0f;
+                break;
+            }
+            case Movement::Still:
+            {
+                //Nudging the last bit so every send is a new value the server has to relay.
+                x = std::nextafter(x, x == spawnX ? spawnX + 1.0f : spawnX);
+                break;
+            }
+            }
+        }
+
+        SimpleNet::NetClient client;
+        SimpleNet::StateSender stateOut;
+        SimpleNet::StateReceiver stateIn;
+        std::deque<Sent> sentPositions;
+
+        std::mt19937 rng;
+        Movement movement;
+        State state = State::Idle;
+        Clock::time_point connectStarted;
+
+        float x = 0, y = 0;
+        float spawnX = 0, spawnY = 0;
+        float targetX = 0, targetY = 0;
+        float angle = 0;
+
+        uint32_t selfId = 0;
+        bool knowsSelf = false;
+    };
+}
+
+int main(int argc, char** argv)
+{
+    Options opt;
+    if (!parseArgs(argc, argv, opt))
+    {
+        return 1;
+    }
+
+    if (!SimpleNet::Net::Initialize())
+    {
+        return 1;
+    }
+
+    Totals totals;
+    {
+        std::vector<std::unique_ptr<Bot>> bots;
+        bots.reserve(opt.bots);
+        for (uint32_t i = 0; i < opt.bots; ++i)
+        {
+            bots.push_back(std::make_unique<Bot>(i * 7919u + 1, opt.movement));
+        }
+
+        const Clock::duration tickLength = std::chrono::duration_cast<Clock::duration>(std::chrono::seconds(1)) / opt.inputRate;
+        const Clock::time_point begin = Clock::now();
+        const Clock::time_point end = begin + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(opt.seconds));
+        Clock::time_point nextTick = begin;
+        Clock::time_point nextSample = begin + std::chrono::seconds(1);
+        uint32_t started = 0;
+        std::vector<PollFd> fds;
+        std::vector<Bot*> polled;
+
+        std::cerr << "Starting " << opt.bots << " bots against " << opt.host << ":" << opt.port << "\n";
+
+        while (Clock::now() < end)
+        {
+            //Connecting a few at a time, a thousand handshakes at once would only measure the burst.
+            double elapsed = std::chrono::duration<double>(Clock::now() - begin).count();
+            uint32_t due = std::min<uint32_t>(opt.bots, static_cast<uint32_t>(elapsed * opt.ramp) + 1);
+            for (; started < due; ++started)
+            {
+                if (!bots[started]->start(opt))
+                {
+                    ++totals.connectFailures;
+                }
+            }
+
+            for (auto& bot : bots)
+            {
+                bot->tick(totals);
+            }
+
+            if (Clock::now() >= nextSample)
+            {
+                nextSample += std::chrono::seconds(1);
+                size_t connected = 0;
+                for (const auto& bot : bots)
+                {
+                    bot->sampleLink(totals);
+                    connected += bot->current() == Bot::State::Connected;
+                }
+                std::cerr << static_cast<int>(elapsed) << "s: " << connected << "/" << opt.bots << " connected\n";
+            }
+
+            //Falling behind just means the next tick starts straight away, bots never send in bursts.
+            nextTick = std::max(nextTick + tickLength, Clock::now());
+
+            //Until then, one wait on every bot's socket. Readable bots and bots with ENet timers due get serviced.
+            for (Clock::time_point now = Clock::now(); now < nextTick; now = Clock::now())
+            {
+                uint32_t wait = static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::milliseconds>(nextTick - now).count()) + 1;
+                fds.clear();
+                polled.clear();
+                for (auto& bot : bots)
+                {
+                    if (bot->active() && bot->socket() != ENET_SOCKET_NULL)
+                    {
+                        wait = std::min(wait, bot->nextTimeoutMs(wait));
+                        fds.push_back(PollFd{});
+                        fds.back().fd = bot->socket();
+                        fds.back().events = POLLIN;
+                        polled.push_back(bot.get());
+                    }
+                }
+
+                if (fds.empty())
+                {
+                    std::this_thread::sleep_until(nextTick);
+                    break;
+                }
+
+                pollSockets(fds.data(), fds.size(), static_cast<int>(wait));
+                for (size_t i = 0; i < fds.size(); ++i)
+                {
+                    if (fds[i].revents || polled[i]->nextTimeoutMs(1) == 0)
+                    {
+                        polled[i]->pump(totals);
+                    }
+                }
+            }
+        }
+
+        for (auto& bot : bots)
+        {
+            bot->stop();
+        }
+    }
+    SimpleNet::Net::Deinitialize();
+
+    std::ostringstream json;
+    json << "{\n  \"benchmark\": \"bots\",\n  \"bots\": " << opt.bots << ",\n  \"input_rate\": " << opt.inputRate
+         << ",\n  \"seconds\": " << opt.seconds
+         << ",\n  \"rtt_ms\": " << toJson(summarize(totals.rtt))
+         << ",\n  \"loss_percent\": " << toJson(summarize(totals.loss))
+         << ",\n  \"response_ms\": " << toJson(summarize(totals.response))
+         << ",\n  \"connect_ms\": " << toJson(summarize(totals.connect))
+         << ",\n  \"connect_failures\": " << totals.connectFailures << ",\n  \"drops\": " << totals.drops
+         << ",\n  \"positions_sent\": " << totals.positionsSent << ",\n  \"updates_received\": " << totals.updatesReceived << "\n}\n";
+
+    if (opt.outPath.empty())
+    {
+        std::cout << json.str();
+    }
+    else
+    {
+        std::ofstream out(opt.outPath);
+        out << json.str();
+    }
+
+    return 0;
+}
@@ -0,0 +1,160 @@
+// TrafficTrainer: builds a TrainedModel for Compression::Trained from recorded traffic.
+//
+// Record traffic by calling captureTraffic("server.cap") on a NetServer and/or NetClient while
+// playing normally, then train on the captures:
+//
+//     TrafficTrainer --out game.model server.cap client.cap
+//
+// Every --holdout'th datagram (default 10) is kept out of training and used to report how the
+// model does against the bundled LZ codec on traffic it has not seen. Load the result on both ends
+// with setCompressionModel(SimpleNet::TrainedModel::load("game.model")).
+//
+// Usage: TrafficTrainer --out FILE [--holdout N] CAPTURE...
+
+#include "SimpleNet.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace
+{
+    struct Options
+    {
+        std::string outPath;
+        uint32_t holdout = 10;
+        std::vector<std::string> captures;
+    };
+
+    bool parseArgs(int argc, char** argv, Options& opt)
+    {
+        for (int i = 1; i < argc; ++i)
+        {
+            std::string a = argv[i];
+            bool hasValue = i + 1 < argc;
+
+            if (a == "--out" && hasValue) opt.outPath = argv[++i];
+            else if (a == "--holdout" && hasValue) opt.holdout = static_cast<uint32_t>(std::atoi(argv[++i]));
+            else if (!a.empty() && a[0] != '-') opt.captures.push_back(a);
+            else
+            {
+                opt.captures.clear();
+                break;
+            }
+        }
+
+        if (opt.outPath.empty() || opt.captures.empty())
+        {
+            std::cerr << "Usage: TrafficTrainer --out FILE [--holdout N] CAPTURE...\n";
+            return false;
+        }
+        return true;
+    }
+
+    //Compressed size with a codec, or the original size when it did not pay off (what ENet would send).
+    template<typename Fn>
+    size_t sentSize(const std::vector<uint8_t>& d, Fn&& compress)
+    {
+        uint8_t out[ENET_PROTOCOL_MAXIMUM_MTU];
+        size_t size = compress(d.data(), d.size(), out, sizeof(out));
+        return (size && size < d.size()) ? size : d.size();
+    }
+}
+
+int main(int argc, char** argv)
+{
+    Options opt;
+    if (!parseArgs(argc, argv, opt))
+    {
+        return 1;
+    }
+
+    std::vector<std::vector<uint8_t>> datagrams;
+    for (const std::string& path : opt.captures)
+    {
+        if (!SimpleNet::TrafficCapture::readAll(path, datagrams))
+        {
+            return 1;
+        }
+    }
+
+    if (datagrams.empty())
+    {
+        std::cerr << "No datagrams in the captures\n";
+        return 1;
+    }
+
+    //Order-1 counts: how often each byte follows each other byte.
+    std::vector<uint64_t> counts(SimpleNet::TrainedModel::Symbols * SimpleNet::TrainedModel::Symbols, 0);
+    std::vector<const std::vector<uint8_t>*> holdout;
+    uint64_t trainedBytes = 0;
+
+    for (size_t i = 0; i < datagrams.size(); ++i)
+    {
+        const std::vector<uint8_t>& d = datagrams[i];
+        if (opt.holdout > 1 && i % opt.holdout == opt.holdout - 1)
+        {
+            holdout.push_back(&d);
+            continue;
+        }
+
+        for (size_t k = 0; k < d.size(); ++k)
+        {
+            uint8_t ctx = k ? d[k - 1] : 0;
+            ++counts[ctx * SimpleNet::TrainedModel::Symbols + d[k]];
+        }
+        trainedBytes += d.size();
+    }
+
+    std::shared_ptr<SimpleNet::TrainedModel> model = SimpleNet::TrainedModel::fromCounts(counts);
+    if (!model || !model->save(opt.outPath))
+    {
+        std::cerr << "Failed to write " << opt.outPath << "\n";
+        return 1;
+    }
+
+    std::cout << "Trained on " << (datagrams.size() - holdout.size()) << " datagrams (" << trainedBytes << " bytes), wrote " << opt.outPath << "\n";
+
+    if (holdout.empty())
+    {
+        return 0;
+    }
+
+    //Checking the model on the held out traffic, and that it round trips.
+    uint64_t raw = 0, trained = 0, lz = 0;
+    uint64_t small = 0, smallTrained = 0, smallLz = 0;
+    for (const std::vector<uint8_t>* d : holdout)
+    {
+        size_t t = sentSize(*d, [&](const uint8_t* src, size_t n, uint8_t* out, size_t cap)
+        {
+            size_t size = SimpleNet::TrainedCodec::compressBlock(*model, src, n, out, cap);
+            uint8_t back[ENET_PROTOCOL_MAXIMUM_MTU];
+            if (size && (SimpleNet::TrainedCodec::decompressBlock(*model, out, size, back, sizeof(back)) != n || std::memcmp(back, src, n) != 0))
+            {
+                std::cerr << "Round trip failed on a " << n << " byte datagram\n";
+                std::exit(1);
+            }
+            return size;
+        });
+        size_t l = sentSize(*d, &SimpleNet::LzCodec::compressBlock);
+
+        raw += d->size();
+        trained += t;
+        lz += l;
+
+        if (d->size() < 100)
+        {
+            small += d->size();
+            smallTrained += t;
+            smallLz += l;
+        }
+    }
+
+    auto ratio = [](uint64_t out, uint64_t in) { return in ? static_cast<double>(out) / in : 1.0; };
+    std::cout << "Held out " << holdout.size() << " datagrams (" << raw << " bytes)\n"
+              << "  trained ratio " << ratio(trained, raw) << ", lz ratio " << ratio(lz, raw) << "\n"
+              << "  under 100 bytes: trained ratio " << ratio(smallTrained, small) << ", lz ratio " << ratio(smallLz, small) << "\n";
+    return 0;
+}